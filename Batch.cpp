@@ -0,0 +1,309 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define PARSER_IMPL
+#include "Parser.hpp"
+
+static constexpr size_t READ_SIZE = 1 << 20;
+static constexpr size_t ROWS_PER_BLOCK = 1 << 16;
+
+struct Options
+{
+	std::string formula;
+	std::string input;
+	std::string output;
+	unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+	bool radians = true;
+};
+
+// Names are lower-cased, as the parser lower-cases the formula that refers to them.
+static std::vector<std::string> SplitHeader(std::string_view line)
+{
+	std::vector<std::string> names;
+
+	for (size_t begin = 0, end; begin <= line.size(); begin = end + 1)
+	{
+		end = std::min(line.find(',', begin), line.size());
+
+		std::string_view name = line.substr(begin, end - begin);
+		name.remove_prefix(std::min(name.find_first_not_of(" \t\r"), name.size()));
+		name = name.substr(0, name.find_last_not_of(" \t\r") + 1);
+
+		std::string& lower = names.emplace_back(name);
+
+		for (char& c : lower)
+			c = (char)std::tolower((unsigned char)c);
+	}
+
+	return names;
+}
+
+// Moves an offset forward to the start of the next line, unless it already starts one.
+static off_t AlignToLine(int fd, off_t offset, off_t size)
+{
+	char c;
+
+	if (offset <= 0 || offset >= size || (pread(fd, &c, 1, offset - 1) == 1 && c == '\n'))
+		return std::min(offset, size);
+
+	char buffer[4096];
+
+	while (offset < size)
+	{
+		ssize_t count = pread(fd, buffer, sizeof(buffer), offset);
+
+		if (count <= 0)
+			return size;
+
+		const char* newline = (const char*)std::memchr(buffer, '\n', count);
+
+		if (newline)
+			return offset + (newline - buffer) + 1;
+
+		offset += count;
+	}
+
+	return size;
+}
+
+static bool EvaluateShard(const Options& options, const std::vector<std::string>& names, off_t begin, off_t end, const std::string& path)
+{
+	Parser parser;
+
+	for (const std::string& name : names)
+		parser.AddVariable(name);
+
+	std::string_view formulas[] = { options.formula };
+	Program program = parser.Compile(formulas);
+
+	if (!parser.IsOk())
+	{
+		std::cerr << "Can't compile \"" << options.formula << "\"" << std::endl;
+		return false;
+	}
+
+	int fd = open(options.input.c_str(), O_RDONLY);
+	std::ofstream output(path, std::ios::binary);
+
+	if (fd < 0 || !output)
+		return false;
+
+	std::vector<std::vector<double>> columns(names.size());
+	std::vector<double> results;
+
+	auto flush = [&]()
+	{
+		size_t rows = columns.empty() ? 0 : columns[0].size();
+
+		Parser::Columns inputs;
+
+		for (size_t i = 0; i < names.size(); i++)
+			inputs.emplace(names[i], std::span<const double>(columns[i]));
+
+		results.resize(rows);
+		std::span<double> outputs[] = { results };
+
+		if (!parser.Evaluate(program, options.radians, inputs, outputs))
+			return false;
+
+		char buffer[32];
+
+		for (double result : results)
+			output.write(buffer, std::snprintf(buffer, sizeof(buffer), "%.17g\n", result));
+
+		for (std::vector<double>& column : columns)
+			column.clear();
+
+		return true;
+	};
+
+	std::string pending;
+	std::vector<char> buffer(READ_SIZE);
+
+	size_t position = 0;
+
+	for (off_t offset = begin; offset < end || position < pending.size();)
+	{
+		size_t newline = pending.find('\n', position);
+
+		if (newline == std::string::npos && offset < end)
+		{
+			ssize_t count = pread(fd, buffer.data(), std::min<off_t>(READ_SIZE, end - offset), offset);
+
+			if (count <= 0)
+				break;
+
+			pending.erase(0, position);
+			pending.append(buffer.data(), count);
+
+			position = 0;
+			offset += count;
+
+			continue;
+		}
+
+		newline = std::min(newline, pending.size());
+
+		std::string_view line = std::string_view(pending).substr(position, newline - position);
+		const char* cursor = line.data();
+
+		if (line.find_first_not_of(" \t\r") != std::string_view::npos)
+		{
+			for (size_t i = 0; i < names.size(); i++)
+			{
+				char* next;
+				columns[i].push_back(std::strtod(cursor, &next));
+
+				bool last = i + 1 == names.size();
+
+				// The last field must end the row; anything after it is a field the header doesn't name.
+				if (next == cursor || (!last && *next != ',') ||
+					(last && line.substr(next - line.data()).find_first_not_of(" \t\r") != std::string_view::npos))
+				{
+					std::cerr << "Malformed row \"" << line << "\"" << std::endl;
+					return false;
+				}
+
+				cursor = next + 1;
+			}
+		}
+
+		position = newline + 1;
+
+		if (!columns.empty() && columns[0].size() == ROWS_PER_BLOCK && !flush())
+			return false;
+	}
+
+	close(fd);
+	return flush() && output.good();
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string_view argument = argv[i];
+
+		if (argument == "--workers" && i + 1 < argc)
+			options.workers = std::max(1, std::atoi(argv[++i]));
+		else if (argument == "--degrees")
+			options.radians = false;
+		else if (options.formula.empty())
+			options.formula = argument;
+		else if (options.input.empty())
+			options.input = argument;
+		else
+			options.output = argument;
+	}
+
+	if (options.output.empty())
+	{
+		std::cerr << "Usage: " << argv[0] << " <formula> <input.csv> <output> [--workers n] [--degrees]" << std::endl;
+		return 1;
+	}
+
+	int fd = open(options.input.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		std::cerr << "Can't open " << options.input << std::endl;
+		return 1;
+	}
+
+	std::ifstream input(options.input);
+	std::string header;
+	std::getline(input, header);
+
+	std::vector<std::string> names = SplitHeader(header);
+
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		if (std::find(names.begin(), names.begin() + i, names[i]) != names.begin() + i)
+		{
+			std::cerr << "Duplicate column \"" << names[i] << "\"" << std::endl;
+			return 1;
+		}
+	}
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	off_t start = AlignToLine(fd, (off_t)header.size(), size);
+
+	std::vector<off_t> bounds = { start };
+
+	for (unsigned i = 1; i < options.workers; i++)
+		bounds.push_back(std::max(bounds.back(), AlignToLine(fd, start + (size - start) * i / options.workers, size)));
+
+	bounds.push_back(size);
+	close(fd);
+
+	std::vector<pid_t> workers;
+
+	for (unsigned i = 0; i < options.workers; i++)
+	{
+		pid_t pid = fork();
+
+		if (pid == 0)
+			_exit(EvaluateShard(options, names, bounds[i], bounds[i + 1], options.output + ".part" + std::to_string(i)) ? 0 : 1);
+
+		if (pid < 0)
+		{
+			std::cerr << "Can't start worker: " << std::strerror(errno) << std::endl;
+
+			for (size_t j = 0; j < workers.size(); j++)
+			{
+				kill(workers[j], SIGKILL);
+				while (waitpid(workers[j], nullptr, 0) < 0 && errno == EINTR);
+
+				unlink((options.output + ".part" + std::to_string(j)).c_str());
+			}
+
+			return 1;
+		}
+
+		workers.push_back(pid);
+	}
+
+	bool ok = true;
+
+	for (pid_t pid : workers)
+	{
+		int status = 0;
+		pid_t result;
+
+		while ((result = waitpid(pid, &status, 0)) < 0 && errno == EINTR);
+
+		ok = ok && result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	std::ofstream output(options.output, std::ios::binary);
+
+	for (unsigned i = 0; i < options.workers; i++)
+	{
+		std::string part = options.output + ".part" + std::to_string(i);
+
+		std::ifstream shard(part, std::ios::binary);
+
+		if (ok && shard.peek() != std::ifstream::traits_type::eof())
+			output << shard.rdbuf();
+
+		shard.close();
+		unlink(part.c_str());
+	}
+
+	if (!ok || !output)
+	{
+		std::cerr << "Evaluation failed" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+
+#define PARSER_IMPL
+#include "Parser.hpp"
+
+struct Columns
+{
+	Columns(std::pmr::memory_resource* resource, size_t rows, size_t skew) :
+		x(rows + skew, resource), y(rows + skew, resource), result(rows + skew, resource)
+	{
+		for (size_t i = 0; i < rows; i++)
+		{
+			x[skew + i] = i * 1e-6;
+			y[skew + i] = 1.0 / (i + 1);
+		}
+
+		inputs.emplace("x", std::span<const double>(x).subspan(skew, rows));
+		inputs.emplace("y", std::span<const double>(y).subspan(skew, rows));
+
+		output = std::span<double>(result).subspan(skew, rows);
+	}
+
+	std::pmr::vector<double> x, y, result;
+	Parser::Columns inputs;
+	std::span<double> output;
+};
+
+static size_t GetHugePages()
+{
+	std::ifstream smaps("/proc/self/smaps_rollup");
+	std::string key;
+
+	for (size_t value; smaps >> key >> value; smaps.ignore(64, '\n'))
+		if (key == "AnonHugePages:")
+			return value;
+
+	return 0;
+}
+
+static double Measure(Parser& parser, const Program& program, Columns& columns, unsigned repeats)
+{
+	std::span<double> outputs[] = { columns.output };
+
+	parser.Evaluate(program, true, columns.inputs, outputs);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < repeats; i++)
+		parser.Evaluate(program, true, columns.inputs, outputs);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / repeats;
+}
+
+int main(int argc, char** argv)
+{
+	size_t rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 24;
+	unsigned repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+	std::string formula = argc > 3 ? argv[3] : "x * y + x - y";
+
+	Parser parser;
+	parser.AddVariable("x");
+	parser.AddVariable("y");
+
+	std::string_view formulas[] = { formula };
+	Program program = parser.Compile(formulas);
+
+	if (!parser.IsOk())
+	{
+		std::cerr << "Can't compile \"" << formula << "\"" << std::endl;
+		return 1;
+	}
+
+	AlignedResource small(std::pmr::new_delete_resource(), false);
+	AlignedResource huge;
+
+	struct Case
+	{
+		const char* name;
+		std::pmr::memory_resource* resource;
+		size_t skew;
+	};
+
+	Case cases[] =
+	{
+		{ "aligned, huge pages", &huge, 0 },
+		{ "aligned, small pages", &small, 0 },
+		{ "misaligned, small pages", &small, 1 }
+	};
+
+	std::cout << rows << " rows, " << repeats << " repeats, \"" << formula << "\"" << std::endl;
+
+	for (const Case& test : cases)
+	{
+		size_t before = GetHugePages();
+		Columns columns(test.resource, rows, test.skew);
+		size_t after = GetHugePages();
+		size_t backed = after > before ? after - before : 0;
+
+		double seconds = Measure(parser, program, columns, repeats);
+
+		std::printf("%-26s %8.3f ms  %7.1f Mrows/s  %8zu KiB in huge pages\n",
+			test.name, seconds * 1e3, rows / seconds / 1e6, backed);
+	}
+
+	// Fixed-point evaluation against the floating-point engine on the same inputs.
+	Columns columns(&small, rows, 0);
+
+	for (auto [integerBits, fractionBits] : { std::pair(31u, 32u), std::pair(15u, 16u) })
+	{
+		auto start = std::chrono::steady_clock::now();
+		FixedPoint::Report report = parser.CompareFixed(program, FixedPoint(integerBits, fractionBits), true, columns.inputs);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::printf("Q%u.%-22u %8.3f ms  max error %.3g at row %zu, mean %.3g, %zu saturated, %zu undefined\n",
+			integerBits, fractionBits, elapsed.count() * 1e3, report.maxError, report.worstRow, report.meanError, report.saturations, report.undefined);
+	}
+
+	return 0;
+}
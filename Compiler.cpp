@@ -0,0 +1,104 @@
+#include <iostream>
+#include <fstream>
+
+#define PARSER_IMPL
+#include "Parser.hpp"
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <formulas> <output.cpp> [--degrees]" << std::endl;
+		return 1;
+	}
+
+	std::ifstream input(argv[1]);
+
+	if (!input)
+	{
+		std::cerr << "Can't open " << argv[1] << std::endl;
+		return 1;
+	}
+
+	bool radians = !(argc > 3 && std::string_view(argv[3]) == "--degrees");
+
+	Parser parser;
+
+	std::vector<std::string> names;
+	std::vector<Program> programs;
+
+	std::string line;
+
+	for (size_t number = 1; std::getline(input, line); number++)
+	{
+		size_t start = line.find_first_not_of(" \t");
+
+		if (start == std::string::npos || line[start] == '#')
+			continue;
+
+		std::string_view text = std::string_view(line).substr(start);
+
+		if (text.starts_with("var "))
+		{
+			for (size_t begin = 4, end; begin < text.size(); begin = end + 1)
+			{
+				end = std::min(text.find(',', begin), text.size());
+
+				std::string_view name = text.substr(begin, end - begin);
+				name.remove_prefix(std::min(name.find_first_not_of(" \t"), name.size()));
+				name = name.substr(0, name.find_last_not_of(" \t") + 1);
+
+				if (!name.empty())
+					parser.AddVariable(name);
+			}
+
+			continue;
+		}
+
+		std::string_view formula = text;
+		size_t colon = text.find(':');
+
+		bool ok = false;
+
+		if (!text.starts_with("def ") && colon != std::string_view::npos)
+		{
+			names.emplace_back(text.substr(0, text.find_last_not_of(" \t", colon - 1) + 1));
+			formula = text.substr(colon + 1);
+
+			Expression expr = parser.Parse(formula).Canonicalize();
+			ok = parser.IsOk() && !expr.Empty();
+
+			if (ok)
+			{
+				Graph graph;
+				graph.Add(expr);
+
+				programs.push_back(parser.Compile(graph));
+				ok = parser.IsOk();
+			}
+		}
+		else
+		{
+			parser.Get(formula, radians);
+			ok = parser.IsOk();
+		}
+
+		if (!ok)
+		{
+			std::cerr << argv[1] << ":" << number << ": can't compile \"" << formula << "\"" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<std::string_view> views(names.begin(), names.end());
+	std::string source = parser.Translate(views, programs, radians);
+
+	if (!parser.IsOk())
+	{
+		std::cerr << "Formulas use functions or operators that can't be translated" << std::endl;
+		return 1;
+	}
+
+	std::ofstream(argv[2]) << source;
+	return 0;
+}
@@ -0,0 +1,549 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <random>
+#include <atomic>
+
+#include <sys/wait.h>
+#include <signal.h>
+
+#define PARSER_IMPL
+#include "Parser.hpp"
+
+#define SERVER_IMPL
+#include "Server.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode
+{
+	InProcess,
+	Repl,
+	Server
+};
+
+struct Options
+{
+	Mode mode = Mode::InProcess;
+	std::string binary = "./Source";
+	std::string socket = "/tmp/mathparser.sock";
+	std::vector<std::string> formulas = { "x * y + 1", "sin(x) ^ 2 + cos(y) ^ 2", "sqrt(x * x + y * y)" };
+
+	unsigned threads = 4;
+	unsigned requests = 10000;
+	unsigned depth = 8;
+	unsigned rows = 16;
+
+	double hitRatio = 1.0;
+	double duration = 0.0;
+	double interval = 1.0;
+};
+
+struct Child
+{
+	pid_t pid = -1;
+	int input = -1;
+	int output = -1;
+};
+
+static constexpr int REPL_TIMEOUT = 10000;
+
+static std::atomic<uint64_t> s_Completed = 0;
+static std::atomic<bool> s_Failed = false;
+
+static Child Spawn(const Options& options, std::vector<std::string> arguments)
+{
+	int in[2], out[2];
+	Child child;
+
+	if (pipe(in) < 0)
+		return child;
+
+	if (pipe(out) < 0)
+	{
+		close(in[0]);
+		close(in[1]);
+
+		return child;
+	}
+
+	child.pid = fork();
+
+	if (child.pid < 0)
+	{
+		for (int fd : { in[0], in[1], out[0], out[1] })
+			close(fd);
+
+		return child;
+	}
+
+	if (child.pid == 0)
+	{
+		// The load generator ignores SIGPIPE for itself; the child gets the default back.
+		signal(SIGPIPE, SIG_DFL);
+
+		// Errors share the output pipe, so a reader waiting for one line per input also sees failed inputs.
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(out[1], STDERR_FILENO);
+
+		close(in[1]);
+		close(out[0]);
+
+		std::vector<char*> argv = { (char*)options.binary.c_str() };
+
+		for (std::string& argument : arguments)
+			argv.push_back(argument.data());
+
+		argv.push_back(nullptr);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+
+	child.input = in[1];
+	child.output = out[0];
+
+	return child;
+}
+
+static void Stop(Child& child)
+{
+	if (child.input >= 0)
+		close(child.input);
+
+	if (child.output >= 0)
+		close(child.output);
+
+	if (child.pid > 0)
+	{
+		kill(child.pid, SIGTERM);
+		waitpid(child.pid, nullptr, 0);
+	}
+
+	child = Child();
+}
+
+static size_t GetResidentSize(pid_t pid)
+{
+	std::ifstream status("/proc/" + (pid > 0 ? std::to_string(pid) : std::string("self")) + "/status");
+	std::string line;
+
+	while (std::getline(status, line))
+	{
+		if (line.starts_with("VmRSS:"))
+			return std::strtoull(line.c_str() + 6, nullptr, 10);
+	}
+
+	return 0;
+}
+
+static bool WriteAll(int fd, std::string_view data)
+{
+	while (!data.empty())
+	{
+		ssize_t count = write(fd, data.data(), data.size());
+
+		if (count <= 0)
+			return false;
+
+		data.remove_prefix(count);
+	}
+
+	return true;
+}
+
+class Workload
+{
+public:
+	Workload(const Options& options, unsigned seed) : m_Options(options), m_Random(seed), m_Seed(seed)
+	{
+		m_X.resize(options.rows);
+		m_Y.resize(options.rows);
+
+		for (unsigned i = 0; i < options.rows; i++)
+		{
+			m_X[i] = 0.01 * (i + seed);
+			m_Y[i] = 0.02 * (i + seed);
+		}
+	}
+
+	// Cache misses get a unique literal appended, which changes the canonical hash.
+	std::string Next()
+	{
+		std::string formula = m_Options.formulas[m_Random() % m_Options.formulas.size()];
+
+		if (std::uniform_real_distribution<double>(0.0, 1.0)(m_Random) >= m_Options.hitRatio)
+			formula = "(" + formula + ") + 0.000000001 * " + std::to_string(m_Seed) + "." + std::to_string(m_Unique++);
+
+		return formula;
+	}
+
+	bool More(Clock::time_point start, unsigned done) const
+	{
+		if (m_Options.duration > 0.0)
+			return std::chrono::duration<double>(Clock::now() - start).count() < m_Options.duration;
+
+		return done < m_Options.requests;
+	}
+
+	const std::vector<double>& GetX() const { return m_X; }
+	const std::vector<double>& GetY() const { return m_Y; }
+
+private:
+	const Options& m_Options;
+	std::mt19937 m_Random;
+	unsigned m_Seed;
+	unsigned m_Unique = 0;
+
+	std::vector<double> m_X;
+	std::vector<double> m_Y;
+};
+
+static bool RunInProcess(const Options& options, unsigned seed, Clock::time_point start, std::vector<double>& latencies)
+{
+	Workload workload(options, seed);
+
+	Parser parser;
+	parser.AddVariable("x");
+	parser.AddVariable("y");
+
+	std::unordered_map<std::string, Program> cache;
+
+	Parser::Columns columns;
+	columns.emplace("x", std::span<const double>(workload.GetX()));
+	columns.emplace("y", std::span<const double>(workload.GetY()));
+
+	std::vector<double> output(options.rows);
+	std::span<double> outputs[] = { output };
+
+	for (unsigned done = 0; workload.More(start, done); done++)
+	{
+		std::string formula = workload.Next();
+		Clock::time_point started = Clock::now();
+
+		auto program = cache.find(formula);
+
+		if (program == cache.end())
+		{
+			std::string_view inputs[] = { formula };
+			program = cache.emplace(formula, parser.Compile(inputs)).first;
+		}
+
+		if (!parser.Evaluate(program->second, true, columns, outputs))
+			return false;
+
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - started).count());
+		s_Completed++;
+	}
+
+	return true;
+}
+
+static bool DriveRepl(const Options& options, Workload& workload, const Child& child, Clock::time_point start, std::vector<double>& latencies)
+{
+	std::string input;
+	char buffer[65536];
+
+	// The REPL has no variables, so every row is sent as its own line with x and y bound by let statements.
+	for (unsigned done = 0; workload.More(start, done); done++)
+	{
+		std::string formula = workload.Next(), lines;
+
+		for (unsigned i = 0; i < options.rows; i++)
+			lines += "let x = " + std::to_string(workload.GetX()[i]) + "; let y = " + std::to_string(workload.GetY()[i]) + "; " + formula + "\n";
+
+		Clock::time_point started = Clock::now();
+
+		if (!WriteAll(child.input, lines))
+			return false;
+
+		for (unsigned received = 0; received < options.rows;)
+		{
+			size_t newline = input.find('\n');
+
+			if (newline != std::string::npos)
+			{
+				input.erase(0, newline + 1);
+				received++;
+				continue;
+			}
+
+			pollfd descriptor = { child.output, POLLIN, 0 };
+
+			if (poll(&descriptor, 1, REPL_TIMEOUT) <= 0)
+				return false;
+
+			ssize_t count = read(child.output, buffer, sizeof(buffer));
+
+			if (count <= 0)
+				return false;
+
+			input.append(buffer, count);
+		}
+
+		latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - started).count());
+		s_Completed++;
+	}
+
+	return true;
+}
+
+static bool RunRepl(const Options& options, unsigned seed, Clock::time_point start, std::vector<double>& latencies, std::atomic<pid_t>& pid)
+{
+	Workload workload(options, seed);
+	Child child = Spawn(options, {});
+
+	if (child.pid < 0)
+		return false;
+
+	pid = child.pid;
+
+	bool ok = DriveRepl(options, workload, child, start, latencies);
+
+	// The sampler stops reading the child's memory before it is reaped, on success and failure alike.
+	pid = -1;
+	Stop(child);
+
+	return ok;
+}
+
+static bool RunServer(const Options& options, unsigned seed, Clock::time_point start, std::vector<double>& latencies)
+{
+	Workload workload(options, seed);
+	int fd = Server::Connect(options.socket);
+
+	if (fd < 0)
+		return false;
+
+	std::string_view names[] = { "x", "y" };
+	std::span<const double> columns[] = { workload.GetX(), workload.GetY() };
+
+	std::unordered_map<uint32_t, Clock::time_point> started;
+	std::string output, input;
+
+	uint32_t sent = 0, received = 0;
+	char buffer[65536];
+
+	while (workload.More(start, sent) || received < sent)
+	{
+		output.clear();
+
+		for (; workload.More(start, sent) && sent - received < options.depth; sent++)
+		{
+			Server::EncodeRequest(output, sent, workload.Next(), true, options.rows, names, columns);
+			started[sent] = Clock::now();
+		}
+
+		if (!WriteAll(fd, output))
+			return false;
+
+		if (received == sent)
+			continue;
+
+		ssize_t count = read(fd, buffer, sizeof(buffer));
+
+		if (count <= 0)
+			return false;
+
+		input.append(buffer, count);
+
+		std::string_view view = input;
+		Server::Response response;
+
+		while (Server::DecodeResponse(view, response))
+		{
+			if (response.state != Parser::State::Ok || response.values.size() != options.rows)
+				return false;
+
+			latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - started[response.id]).count());
+			started.erase(response.id);
+
+			received++;
+			s_Completed++;
+		}
+
+		input.erase(0, input.size() - view.size());
+	}
+
+	close(fd);
+	return true;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string_view name = argv[i];
+		const char* value = argv[i + 1];
+
+		if (name == "--mode")
+		{
+			std::string_view mode = value;
+
+			if (mode == "inprocess") options.mode = Mode::InProcess;
+			else if (mode == "repl") options.mode = Mode::Repl;
+			else if (mode == "server") options.mode = Mode::Server;
+			else return false;
+		}
+		else if (name == "--formulas")
+		{
+			std::ifstream file(value);
+			std::string line;
+
+			options.formulas.clear();
+
+			while (std::getline(file, line))
+			{
+				if (!line.empty() && line[0] != '#')
+					options.formulas.push_back(line);
+			}
+
+			if (options.formulas.empty())
+				return false;
+		}
+		else if (name == "--binary") options.binary = value;
+		else if (name == "--socket") options.socket = value;
+		else if (name == "--threads") options.threads = std::max(1, std::atoi(value));
+		else if (name == "--requests") options.requests = std::max(1, std::atoi(value));
+		else if (name == "--depth") options.depth = std::max(1, std::atoi(value));
+		else if (name == "--rows") options.rows = std::max(1, std::atoi(value));
+		else if (name == "--hit-ratio") options.hitRatio = std::atof(value);
+		else if (name == "--duration") options.duration = std::atof(value);
+		else if (name == "--interval") options.interval = std::max(0.1, std::atof(value));
+		else return false;
+	}
+
+	return argc % 2 == 1;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--mode inprocess|repl|server] [--binary path] [--socket path] [--formulas file]" << std::endl;
+		std::cerr << "       [--threads n] [--requests n | --duration seconds] [--depth n] [--rows n] [--hit-ratio r] [--interval seconds]" << std::endl;
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	// REPL threads publish their child's pid here for the sampler.
+	std::vector<std::atomic<pid_t>> children(options.mode == Mode::Repl ? options.threads : 0);
+	Child server;
+
+	for (std::atomic<pid_t>& pid : children)
+		pid = -1;
+
+	if (options.mode == Mode::Server)
+	{
+		server = Spawn(options, { "--server", options.socket });
+
+		for (int attempt = 0; attempt < 200; attempt++)
+		{
+			int fd = Server::Connect(options.socket);
+
+			if (fd >= 0)
+			{
+				close(fd);
+				break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+
+	std::vector<std::vector<double>> latencies(options.threads);
+	std::vector<std::thread> threads;
+
+	Clock::time_point start = Clock::now();
+
+	for (unsigned i = 0; i < options.threads; i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			bool ok = false;
+
+			switch (options.mode)
+			{
+			case Mode::InProcess: ok = RunInProcess(options, i, start, latencies[i]); break;
+			case Mode::Repl: ok = RunRepl(options, i, start, latencies[i], children[i]); break;
+			case Mode::Server: ok = RunServer(options, i, start, latencies[i]); break;
+			}
+
+			if (!ok)
+				s_Failed = true;
+		});
+	}
+
+	std::atomic<bool> done = false;
+
+	std::thread sampler([&]()
+	{
+		while (!done)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(options.interval));
+
+			size_t rss = options.mode == Mode::InProcess ? GetResidentSize(0) : 0;
+
+			if (server.pid > 0)
+				rss += GetResidentSize(server.pid);
+
+			for (const std::atomic<pid_t>& child : children)
+			{
+				pid_t pid = child;
+				rss += pid > 0 ? GetResidentSize(pid) : 0;
+			}
+
+			std::cout << "[" << std::chrono::duration<double>(Clock::now() - start).count() << " s] "
+				<< s_Completed << " requests, rss " << rss / 1024.0 << " MB" << std::endl;
+		}
+	});
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	done = true;
+	sampler.join();
+
+	if (server.pid > 0)
+	{
+		Stop(server);
+		unlink(options.socket.c_str());
+	}
+
+	if (s_Failed)
+	{
+		std::cerr << "Requests failed" << std::endl;
+		return 1;
+	}
+
+	std::vector<double> all;
+
+	for (const std::vector<double>& thread : latencies)
+		all.insert(all.end(), thread.begin(), thread.end());
+
+	if (all.empty())
+	{
+		std::cerr << "No requests completed" << std::endl;
+		return 1;
+	}
+
+	std::sort(all.begin(), all.end());
+
+	auto percentile = [&](double p) { return all[std::min(all.size() - 1, (size_t)(p * all.size()))]; };
+
+	std::cout << "requests:   " << all.size() << " in " << seconds << " s" << std::endl;
+	std::cout << "throughput: " << all.size() / seconds << " requests/s, " << all.size() * options.rows / seconds << " rows/s" << std::endl;
+	std::cout << "latency:    p50 " << percentile(0.5) << " us, p90 " << percentile(0.9) << " us, p99 " << percentile(0.99)
+		<< " us, p99.9 " << percentile(0.999) << " us, max " << all.back() << " us" << std::endl;
+
+	return 0;
+}
@@ -1,21 +1,487 @@
 #ifndef PARSER_HPP
-#undef PARSER_HPP
+#define PARSER_HPP
 
 #include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
 #include <vector>
+#include <span>
 #include <cmath>
+#include <limits>
 #include <numbers>
 #include <unordered_map>
+#include <memory>
+#include <memory_resource>
 #include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <coroutine>
+#include <stop_token>
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <cerrno>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
 
 struct Expression
 {
-	Expression(std::string_view token = "");
-	Expression(std::string_view token, const Expression& rhs);
-	Expression(std::string_view token, const Expression& lhs, const Expression& rhs);
+	using allocator_type = std::pmr::polymorphic_allocator<>;
+
+	enum class Kind : uint8_t
+	{
+		Number,
+		Name,
+		Unary,
+		Binary,
+		Let,
+		Local
+	};
+
+	Expression(const allocator_type& allocator = {});
+	Expression(const Expression& other, const allocator_type& allocator = {});
+	Expression(Expression&& other) noexcept = default;
+	Expression(Expression&& other, const allocator_type& allocator);
+
+	Expression& operator=(const Expression& other) = default;
+	Expression& operator=(Expression&& other) = default;
+
+	bool operator==(const Expression& other) const = default;
+
+	allocator_type get_allocator() const;
+
+	uint32_t Push(Kind kind, uint32_t op = 0, uint32_t firstChild = 0, long double value = 0.0L);
+	uint32_t Intern(std::string_view symbol);
+	void Clear();
+	void Truncate(size_t size);
+
+	size_t Size() const;
+	bool Empty() const;
+	uint32_t Root() const;
+	std::pmr::vector<uint8_t> Statements() const;
+
+	Expression Canonicalize() const;
+	uint64_t Hash() const;
+
+	std::pmr::vector<uint64_t> Hashes(std::pmr::vector<uint8_t>* literals = nullptr, std::pmr::vector<long double>* numbers = nullptr) const;
+	static bool IsCommutative(std::string_view symbol);
+	static bool IsSameNumber(long double a, long double b);
+
+	std::pmr::vector<Kind> kinds;
+	std::pmr::vector<uint32_t> ops;
+	std::pmr::vector<uint32_t> firstChildren;
+	std::pmr::vector<long double> values;
+	std::pmr::vector<std::pmr::string> symbols;
+
+	uint32_t locals = 0;
+};
+
+struct Graph
+{
+	using allocator_type = std::pmr::polymorphic_allocator<>;
+	using Kind = Expression::Kind;
+
+	Graph(const allocator_type& allocator = {});
+
+	uint32_t Add(const Expression& expr);
+	uint32_t Add(const Expression& expr, std::pmr::vector<uint32_t>& nodeMap, std::pmr::vector<uint32_t>& symbolMap);
+	uint32_t Insert(Kind kind, uint32_t op, uint32_t lhs, uint32_t rhs, long double value);
+	uint32_t Intern(std::string_view symbol);
+
+	size_t Size() const;
+
+	static uint64_t Hash(Kind kind, uint32_t op, uint32_t lhs, uint32_t rhs, long double value);
+
+	std::pmr::vector<Kind> kinds;
+	std::pmr::vector<uint32_t> ops;
+	std::pmr::vector<uint32_t> lhs;
+	std::pmr::vector<uint32_t> rhs;
+	std::pmr::vector<long double> values;
+	std::pmr::vector<std::pmr::string> symbols;
+	std::pmr::vector<uint32_t> roots;
+
+	std::pmr::unordered_multimap<uint64_t, uint32_t> index;
+};
+
+struct Program
+{
+	using allocator_type = std::pmr::polymorphic_allocator<>;
+
+	struct Instruction
+	{
+		Expression::Kind kind;
+		uint32_t op;
+		uint32_t target;
+		uint32_t lhs;
+		uint32_t rhs;
+		long double value;
+		bool knownBase;
+		bool knownExponent;
+		uint32_t table = 0;
+
+		bool operator==(const Instruction& other) const;
+	};
+
+	// Linear interpolation over evenly spaced samples of a unary call site, built by Parser::Approximate.
+	struct LookupTable
+	{
+		double low;
+		double high;
+		double scale;
+		double error;
+		bool radians;
+		std::pmr::vector<double> values;
+
+		bool operator==(const LookupTable& other) const = default;
+	};
+
+	Program(const allocator_type& allocator = {});
+
+	bool operator==(const Program& other) const = default;
+
+	std::pmr::vector<Instruction> code;
+	std::pmr::vector<std::pmr::string> symbols;
+	std::pmr::vector<uint32_t> outputs;
+	std::pmr::vector<LookupTable> tables;
+	uint32_t registers = 0;
+};
+
+struct Document
+{
+	using allocator_type = std::pmr::polymorphic_allocator<>;
+
+	struct Group
+	{
+		uint32_t first;
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	Document(const allocator_type& allocator = {});
+
+	void Invalidate();
+
+	std::pmr::string text;
+	Expression expr;
+	std::pmr::vector<Group> groups;
+	std::pmr::vector<long double> values;
+	std::pmr::vector<uint8_t> dirty;
+	bool radians = true;
+	uint64_t generation = 0;
+};
+
+struct CompiledFormula
+{
+	const char* name;
+	unsigned variableCount;
+	const char* const* variables;
+	long double (*scalar)(const long double*);
+	void (*batch)(const double* const*, double*, size_t);
+};
+
+class AlignedResource : public std::pmr::memory_resource
+{
+public:
+	static constexpr size_t CACHE_LINE = 64;
+	static constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+
+	AlignedResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource(), bool hugePages = true);
+
+	static AlignedResource* Shared();
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	bool IsHuge(size_t bytes) const;
+
+	std::pmr::memory_resource* m_Upstream;
+	bool m_HugePages;
+};
+
+#ifndef __SIZEOF_INT128__
+// Two's complement 128-bit integer for compilers without __int128, covering what FixedPoint needs of it.
+class Int128
+{
+public:
+	constexpr Int128(int64_t value = 0) : m_High(value < 0 ? -1 : 0), m_Low((uint64_t)value) {}
+
+	constexpr explicit operator int64_t() const { return (int64_t)m_Low; }
+
+	friend constexpr bool operator==(const Int128& a, const Int128& b) = default;
+	friend constexpr auto operator<=>(const Int128& a, const Int128& b) = default;
+
+	friend constexpr Int128 operator+(const Int128& a, const Int128& b)
+	{
+		uint64_t low = a.m_Low + b.m_Low;
+		return Int128(a.m_High + b.m_High + (low < a.m_Low ? 1 : 0), low);
+	}
+
+	friend constexpr Int128 operator-(const Int128& a, const Int128& b)
+	{
+		return a + -b;
+	}
+
+	constexpr Int128 operator-() const
+	{
+		return Int128(~m_High + (m_Low == 0 ? 1 : 0), ~m_Low + 1);
+	}
+
+	friend constexpr Int128 operator*(const Int128& a, const Int128& b)
+	{
+		// The low halves multiply to 128 bits from 32-bit pieces; the cross terms only reach the high half.
+		uint64_t a0 = a.m_Low & 0xffffffff, a1 = a.m_Low >> 32, b0 = b.m_Low & 0xffffffff, b1 = b.m_Low >> 32;
+		uint64_t middle = (a0 * b0 >> 32) + (a1 * b0 & 0xffffffff) + a0 * b1;
+		uint64_t high = a1 * b1 + (a1 * b0 >> 32) + (middle >> 32);
+
+		return Int128((int64_t)(high + a.m_Low * (uint64_t)b.m_High + (uint64_t)a.m_High * b.m_Low), a.m_Low * b.m_Low);
+	}
+
+	friend constexpr Int128 operator/(const Int128& a, const Int128& b)
+	{
+		bool negative = (a.m_High < 0) != (b.m_High < 0);
+		Int128 quotient = Divide(a.m_High < 0 ? -a : a, b.m_High < 0 ? -b : b).first;
+
+		return negative ? -quotient : quotient;
+	}
+
+	friend constexpr Int128 operator%(const Int128& a, const Int128& b)
+	{
+		Int128 remainder = Divide(a.m_High < 0 ? -a : a, b.m_High < 0 ? -b : b).second;
+		return a.m_High < 0 ? -remainder : remainder;
+	}
+
+	friend constexpr Int128 operator<<(const Int128& a, int shift)
+	{
+		if (shift == 0) return a;
+		if (shift >= 64) return Int128((int64_t)(a.m_Low << (shift - 64)), 0);
+
+		return Int128((int64_t)(((uint64_t)a.m_High << shift) | (a.m_Low >> (64 - shift))), a.m_Low << shift);
+	}
+
+	friend constexpr Int128 operator>>(const Int128& a, int shift)
+	{
+		if (shift == 0) return a;
+		if (shift >= 64) return Int128(a.m_High < 0 ? -1 : 0, (uint64_t)(a.m_High >> (shift - 64)));
+
+		return Int128(a.m_High >> shift, (a.m_Low >> shift) | ((uint64_t)a.m_High << (64 - shift)));
+	}
+
+	constexpr Int128& operator+=(const Int128& other) { return *this = *this + other; }
+	constexpr Int128& operator-=(const Int128& other) { return *this = *this - other; }
+	constexpr Int128& operator>>=(int shift) { return *this = *this >> shift; }
+
+private:
+	constexpr Int128(int64_t high, uint64_t low) : m_High(high), m_Low(low) {}
+
+	// Restoring division of non-negative values.
+	static constexpr std::pair<Int128, Int128> Divide(Int128 dividend, const Int128& divisor)
+	{
+		Int128 quotient, remainder;
+
+		for (int bit = 127; bit >= 0; bit--)
+		{
+			remainder = remainder << 1;
+			remainder.m_Low |= (bit >= 64 ? (uint64_t)dividend.m_High >> (bit - 64) : dividend.m_Low >> bit) & 1;
+
+			if (remainder >= divisor)
+			{
+				remainder -= divisor;
+
+				if (bit >= 64)
+					quotient.m_High |= (int64_t)1 << (bit - 64);
+				else
+					quotient.m_Low |= (uint64_t)1 << bit;
+			}
+		}
+
+		return { quotient, remainder };
+	}
+
+	int64_t m_High;
+	uint64_t m_Low;
+};
+#endif
+
+class FixedPoint
+{
+public:
+	struct Report
+	{
+		size_t rows = 0;
+		size_t undefined = 0;
+		size_t saturations = 0;
+		size_t worstRow = 0;
+		size_t worstOutput = 0;
+		double maxError = 0.0;
+		double meanError = 0.0;
+	};
+
+	FixedPoint(unsigned integerBits = 31, unsigned fractionBits = 32);
+
+	int64_t FromDouble(double value);
+	double ToDouble(int64_t value) const;
+
+	int64_t Add(int64_t a, int64_t b);
+	int64_t Subtract(int64_t a, int64_t b);
+	int64_t Multiply(int64_t a, int64_t b);
+	int64_t Divide(int64_t a, int64_t b);
+	int64_t Modulo(int64_t a, int64_t b);
+	int64_t Power(int64_t a, int64_t b);
+
+	bool Call(std::string_view function, int64_t a, int64_t& result);
+
+	int64_t ToRadians(int64_t degrees);
+	int64_t ToDegrees(int64_t radians);
+
+	unsigned GetIntegerBits() const;
+	unsigned GetFractionBits() const;
+	size_t GetSaturations() const;
+
+private:
+#ifdef __SIZEOF_INT128__
+	using Wide = __int128;
+#else
+	using Wide = Int128;
+#endif
+
+	// Constants in Q2.61, which is also the working precision of the series below.
+	static constexpr int64_t ONE = int64_t(1) << 61;
+	static constexpr int64_t PI = 0x6487ed5110b4611a;
+	static constexpr int64_t LN2 = 0x162e42fefa39ef35;
+	static constexpr int64_t LN10 = 0x49aec6eed554560b;
+	static constexpr int64_t LOG10_2 = 0x09a209a84fbcff7a;
+	static constexpr int64_t SQRT3 = 0x376cf5d0b09954e7;
+	static constexpr int64_t TAN_PI_12 = 0x08930a2f4f66ab19;
+
+	static constexpr double GAMMA[] =
+	{
+		1.0, -0.577191652, 0.988205891, -0.897056937, 0.918206857,
+		-0.756704078, 0.482199394, -0.193527818, 0.035868343
+	};
+
+	static Wide SquareRoot(Wide value);
+
+	int64_t Saturate(Wide value);
+	int64_t Narrow(Wide value);
+	Wide Widen(int64_t value) const;
+
+	int64_t Sqrt(int64_t a);
+	int64_t Exp(int64_t a);
+	int64_t Sin(Wide a);
+	int64_t Atan(Wide a);
+	int64_t Asin(int64_t a);
+	int64_t Factorial(int64_t a);
+	int64_t Logarithm(int64_t a, int& exponent);
+
+	unsigned m_IntegerBits;
+	unsigned m_FractionBits;
+
+	int64_t m_Max;
+	int64_t m_Min;
+
+	size_t m_Saturations = 0;
+};
+
+class WorkerPool
+{
+public:
+	static constexpr size_t CHUNK_SIZE = 65536;
+
+	WorkerPool(unsigned threads = std::thread::hardware_concurrency(), bool pinned = false);
+	~WorkerPool();
+
+	void Submit(std::function<void()> job, unsigned node = 0);
+	void ForEach(size_t count, const std::function<void(size_t, size_t)>& job);
+	void Touch(std::span<double> buffer);
+
+	unsigned GetThreadCount() const;
+	unsigned GetNodeCount() const;
+
+	static WorkerPool& Shared();
+	static std::vector<std::pair<unsigned, int>> Place(const std::vector<std::vector<int>>& topology, unsigned threads);
+
+private:
+	struct Node
+	{
+		std::vector<int> cpus;
+		std::deque<std::function<void()>> jobs;
+		unsigned threads = 0;
+	};
+
+	static std::vector<std::vector<int>> GetTopology();
+
+	void Run(unsigned node, int cpu, bool pinned);
+	bool Take(unsigned node, std::function<void()>& job);
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Ready;
+	std::vector<Node> m_Nodes;
+	std::vector<std::thread> m_Threads;
+	bool m_Stopping = false;
+
+	static thread_local WorkerPool* s_Current;
+};
+
+class AsyncEvaluation;
+
+template <typename Signature>
+class Handler;
+
+template <typename R, typename... Args>
+class Handler<R(Args...)>
+{
+public:
+	using Pointer = R(*)(Args...);
+
+	Handler() = default;
 
-	std::string token;
-	std::vector<Expression> arguments;
+	template <typename F>
+		requires (!std::is_same_v<std::decay_t<F>, Handler> && std::is_invocable_r_v<R, F&, Args...>)
+	Handler(F&& callable)
+	{
+		if constexpr (std::is_convertible_v<F, Pointer>)
+			m_Pointer = callable;
+		else
+			m_Function = std::forward<F>(callable);
+	}
+
+	R operator()(Args... args) const
+	{
+		return m_Pointer ? m_Pointer(args...) : m_Function(args...);
+	}
+
+	explicit operator bool() const
+	{
+		return m_Pointer || m_Function;
+	}
+
+	Pointer GetPointer() const
+	{
+		return m_Pointer;
+	}
+
+private:
+	Pointer m_Pointer = nullptr;
+	std::function<R(Args...)> m_Function;
 };
 
 class Parser
@@ -27,262 +493,4615 @@ public:
 		InvalidSyntax,
 		UnknownBinaryOperator,
 		UnknownUnaryOperator,
-		UnknownExpressionType
+		UnknownExpressionType,
+		InvalidInput,
+		Cancelled,
+		ReadFailed
+	};
+
+	using UnaryHandler = Handler<long double(long double)>;
+	using BinaryHandler = Handler<long double(long double, long double)>;
+	using Kernel = Handler<void(std::span<const double>, std::span<double>)>;
+	using BinaryKernel = void(*)(std::span<double>, std::span<const double>);
+	using Reader = Handler<size_t(std::span<char>)>;
+
+	// A reader returns the number of bytes it wrote, 0 at the end of the input, or READ_FAILED.
+	static constexpr size_t READ_FAILED = SIZE_MAX;
+
+	// Called with the awaiting coroutine when an async evaluation finishes, to resume it somewhere other than the pool.
+	using Resume = Handler<void(std::coroutine_handle<>)>;
+
+	struct NameHash
+	{
+		using is_transparent = void;
+
+		size_t operator()(std::string_view name) const
+		{
+			return std::hash<std::string_view>{}(name);
+		}
+	};
+
+	template <typename T>
+	using Table = std::unordered_map<std::string, T, NameHash, std::equal_to<>>;
+
+	using Columns = std::pmr::unordered_map<std::pmr::string, std::span<const double>, NameHash, std::equal_to<>>;
+	using FixedColumns = std::pmr::unordered_map<std::pmr::string, std::span<const int64_t>, NameHash, std::equal_to<>>;
+	using Scratch = std::pmr::vector<std::pmr::vector<double>>;
+
+	enum class Angle
+	{
+		None,
+		Argument,
+		Result
+	};
+
+	struct Function
+	{
+		UnaryHandler handler;
+		Kernel kernel;
+	};
+
+	struct Operator
+	{
+		BinaryHandler handler;
+		BinaryKernel kernel = nullptr;
+	};
+
+	struct BuiltinFunction
+	{
+		std::string_view name;
+		long double (*handler)(long double);
+		Angle angle;
+	};
+
+	struct BuiltinOperator
+	{
+		std::string_view name;
+		long double (*handler)(long double, long double);
+	};
+
+	struct BuiltinConstant
+	{
+		std::string_view name;
+		long double value;
+	};
+
+	struct Binding
+	{
+		const long double* value = nullptr;
+		const std::span<const double>* column = nullptr;
+		const Function* function = nullptr;
+		const BuiltinFunction* builtinFunction = nullptr;
+		const Operator* op = nullptr;
+		const BuiltinOperator* builtinOperator = nullptr;
+		bool constant = false;
+		char arithmetic = '\0';
+	};
+
+	using Bindings = std::pmr::vector<Binding>;
+
+	struct Local
+	{
+		std::pmr::string name;
+		uint32_t node;
+	};
+
+	struct Range
+	{
+		long double low;
+		long double high;
+	};
+
+	struct Approximation
+	{
+		size_t tables = 0;
+		size_t rejected = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+		double maxError = 0.0;
+	};
+
+	struct Compiled
+	{
+		std::vector<std::string> variables;
+		long double (*scalar)(const long double*);
+		void (*batch)(const double* const*, double*, size_t);
+	};
+
+	struct Definition
+	{
+		std::vector<std::string> parameters;
+		Expression body;
+	};
+
+	struct Registry
+	{
+		Table<Definition> definitions;
+		Table<Compiled> compiled;
+		std::vector<std::string> tokens;
+		Table<long double> constants;
+		Table<long double> variables;
+		Table<Range> ranges;
+		Table<Function> functions;
+		Table<Operator> operators;
+		uint64_t generation = 0;
 	};
 
+	static constexpr size_t BLOCK_SIZE = 256;
+	static constexpr size_t STREAM_CHUNK_SIZE = 65536;
+	static constexpr size_t STREAM_LOOKAHEAD = 4096;
+	static constexpr size_t ASYNC_INLINE_ROWS = 16384;
+	static constexpr double MIXED_TOLERANCE = 1e-12;
+	static constexpr double TABLE_TOLERANCE = 1e-9;
+	static constexpr size_t TABLE_MIN_SIZE = 16;
+	static constexpr size_t TABLE_MAX_SIZE = 1 << 20;
+
 public:
-	Parser();
+	Parser(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 	~Parser();
 
-	long double Get(std::string input, bool radians);
+	long double Get(std::string_view input, bool radians);
+	bool Get(std::string_view input, bool radians, const Columns& inputs, std::span<double> output);
+
+	Expression Parse(std::string_view input);
+	Graph Parse(std::span<const std::string_view> inputs);
+
+	Expression Parse(const Reader& reader);
+	Program Compile(const Reader& reader);
+	Program Compile(int fd);
+
+	Document Open(std::string_view text);
+	bool Edit(Document& document, size_t offset, size_t length, std::string_view replacement);
+	long double Evaluate(Document& document, bool radians);
+
+	long double Evaluate(const Expression& expr, bool radians);
+	bool Evaluate(const Expression& expr, bool radians, const Columns& inputs, std::span<double> output);
+	bool Evaluate(const Graph& graph, bool radians, std::span<long double> outputs);
+
+	Program Compile(const Graph& graph);
+	Program Compile(std::span<const std::string_view> inputs);
+
+	bool Evaluate(const Program& program, bool radians, std::span<long double> outputs);
+	bool Evaluate(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop = {});
+
+	AsyncEvaluation EvaluateAsync(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop = {},
+		Resume resume = {});
+	bool EvaluateParallel(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs,
+		WorkerPool& pool = WorkerPool::Shared(), std::stop_token stop = {});
+	Approximation Approximate(Program& program, bool radians, double tolerance = TABLE_TOLERANCE);
+
+	bool EvaluateFixed(const Program& program, FixedPoint& fixed, bool radians, const FixedColumns& inputs, std::span<const std::span<int64_t>> outputs);
+	FixedPoint::Report CompareFixed(const Program& program, FixedPoint fixed, bool radians, const Columns& inputs);
+
+	bool EvaluateSum(const Program& program, bool radians, const Columns& inputs, size_t rows, std::span<double> sums,
+		WorkerPool& pool = WorkerPool::Shared(), std::stop_token stop = {});
+
+	bool EvaluateMixed(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs,
+		double tolerance = MIXED_TOLERANCE, size_t* refined = nullptr);
+
+	std::string Translate(std::span<const std::string_view> names, std::span<const Program> programs, bool radians);
+
+	bool Load(std::string_view path);
+	const Compiled* GetCompiled(std::string_view name) const;
+
+	uint64_t Hash(std::string_view text);
+
+	long double Evaluate(const Compiled& compiled);
+	bool Evaluate(const Compiled& compiled, const Columns& inputs, std::span<double> output);
 
 	State GetState() const;
 	bool IsOk() const;
 
-	void AddOperator(std::string_view text, const std::function<long double(long double, long double)>& handler);
-	void AddFunction(std::string_view text, const std::function<long double(long double)>& handler);
-	void AddConstant(std::string_view text, long double value);
+	std::pmr::memory_resource* GetResource() const;
+	void SetResource(std::pmr::memory_resource* resource);
+
+	template <typename F>
+	void AddOperator(std::string_view text, F&& handler);
+
+	template <typename F>
+	void AddFunction(std::string_view text, F&& handler);
+
+	void AddConstant(std::string_view text, long double value);
+	void AddVariable(std::string_view text, long double value = 0.0L);
+	void SetVariable(std::string_view text, long double value);
+	void SetRange(std::string_view text, long double low, long double high);
+
+	bool IsReserved(std::string_view name) const;
+
+private:
+	bool ParseToken(std::pmr::string& token);
+
+	uint32_t ParseStatement(Expression& expr);
+	bool ParseDefinition();
+	uint32_t ParseCall(Expression& expr, const Definition& definition);
+	std::string_view ParseIdentifier();
+	std::string_view ScanWord();
+	bool Accept(std::string_view expected);
+	bool Expect(std::string_view expected);
+
+	static uint32_t Inline(Expression& expr, const Definition& definition, std::span<const uint32_t> arguments);
+
+	std::string TranslateInstruction(const Program::Instruction& instruction, const Bindings& bindings,
+		std::span<const int> variables, std::span<const std::string> operands, std::span<const Program::Instruction* const> sources, bool batch, bool radians);
+	static std::string TranslateLiteral(long double value, bool batch);
+	static std::string TranslateString(std::string_view text);
+	uint32_t ParseSimpleExpression(Expression& expr);
+	uint32_t ParseBinaryExpression(Expression& expr, int minPriority);
+
+	Expression ParseStatements(Graph* graph = nullptr);
+
+	void SkipSpace();
+	void Fill(size_t keep = SIZE_MAX);
+	size_t Tell() const;
+	void Seek(size_t position);
+
+	void Reparse(Document& document);
+	bool ReparseGroup(Document& document, size_t index, int64_t shift);
+
+	Bindings Bind(std::span<const std::pmr::string> symbols) const;
+
+	long double Evaluate(const Expression& expr);
+	long double EvaluateNode(Expression::Kind kind, const Binding& binding, long double value, long double a, long double b, bool knownBase);
+	long double EvaluatePower(long double base, long double exponent, bool knownBase);
+
+	void EvaluateBlock(const Expression& expr, std::span<const uint8_t> statements, const Bindings& bindings, size_t offset, std::span<double> output, Scratch& scratch, Scratch& locals);
+	bool EvaluateProgram(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop);
+	void EvaluateBlock(const Program& program, const Bindings& bindings, size_t offset, size_t count, Scratch& registers, Scratch* errors = nullptr);
+	void EstimateError(const Program::Instruction& instruction, const Binding& binding, size_t count, Scratch& registers, Scratch& errors);
+	static double (*FindCondition(std::string_view name))(double);
+	void EvaluateRow(const Program& program, const Bindings& bindings, size_t row, std::span<long double> registers);
+	bool BuildTable(const Binding& binding, Range range, double tolerance, Program::LookupTable& table);
+	void ApplyTable(const Program::LookupTable& table, const Binding& binding, std::span<double> target);
+	static Range Combine(char arithmetic, Range a, Range b);
+
+	int64_t EvaluateFixedNode(const Program::Instruction& instruction, const Binding& binding, FixedPoint& fixed, int64_t a, int64_t b);
+	void ApplyBlock(Expression::Kind kind, const Binding& binding, long double value, size_t offset,
+		std::span<double> target, std::span<const double> rhs, std::span<double> temp, bool knownBase, bool knownExponent);
+	void EvaluatePowerBlock(std::span<double> base, std::span<const double> exponent, bool knownBase, bool knownExponent);
+	static std::span<double> GetScratch(Scratch& scratch, size_t index, size_t count);
+	static double Sum(std::span<const double> values);
+
+	void RegisterOperator(std::string_view text, BinaryHandler handler, BinaryKernel kernel);
+	void RegisterFunction(std::string_view text, UnaryHandler handler, Kernel kernel);
+
+	template <typename F>
+	static void ApplyKernel(std::span<const double> in, std::span<double> out);
+
+	template <typename F>
+	static void ApplyBinaryKernel(std::span<double> lhs, std::span<const double> rhs);
+
+	Registry& GetRegistry();
+	void InsertToken(std::string_view text);
+	std::string_view MatchToken(const char* input) const;
+	const Local* FindLocal(std::string_view name) const;
+	const Definition* FindDefinition(std::string_view name) const;
+
+	const long double* FindConstant(std::string_view name) const;
+	const long double* FindVariable(std::string_view name) const;
+	const Function* FindFunction(std::string_view name) const;
+	const Operator* FindOperator(std::string_view name) const;
+
+	static const BuiltinFunction* FindBuiltinFunction(std::string_view name);
+	static const BuiltinOperator* FindBuiltinOperator(std::string_view name);
+
+	long double CallBuiltin(const BuiltinFunction& function, long double a) const;
+
+	int GetPriority(std::string_view binaryOp);
+
+public:
+	enum class PowerKind
+	{
+		Generic,
+		Integer,
+		Identity,
+		Sqrt,
+		InverseSqrt,
+		Cbrt,
+		Exp,
+		Exp2
+	};
+
+	static constexpr long double MAX_INTEGER_EXPONENT = 64.0L;
+
+	static PowerKind ClassifyPower(long double base, long double exponent);
+	static long double Power(PowerKind kind, long double base, long double exponent);
+	static long double IntegerPower(long double base, long long exponent);
+
+private:
+	static bool IsKnown(const Expression& expr, const Bindings& bindings, uint32_t node);
+	static bool IsKnown(Expression::Kind kind, const Binding& binding);
+
+private:
+	State m_State = State::Ok;
+
+	char* m_Input;
+	char* m_Begin = nullptr;
+
+	const Reader* m_Reader = nullptr;
+	std::pmr::string* m_Buffer = nullptr;
+	size_t m_Consumed = 0;
+	bool m_ReadFailed = false;
+	bool m_Radians;
+
+	std::pmr::vector<Document::Group>* m_Groups = nullptr;
+
+	std::pmr::vector<Local>* m_Locals = nullptr;
+
+	Table<Definition>* m_Definitions = nullptr;
+
+	std::pmr::memory_resource* m_Resource;
+
+	std::shared_ptr<Registry> m_Registry;
+
+	static std::atomic<uint64_t> s_Generation;
+
+	static constexpr std::string_view TOKENS[] =
+	{
+		"+", "-", "^", "*", "/", "%", "(", ")", "!", "e", "lg", "ln", "pi", "abs", "sin", "cos", "tan",
+		"sqrt", "asin", "acos", "atan", "log2", "=", ";", ",", "let", "def"
+	};
+
+	static constexpr BuiltinConstant CONSTANTS[] =
+	{
+		{ "pi", std::numbers::pi_v<long double> },
+		{ "e", std::numbers::e_v<long double> }
+	};
+
+	static constexpr BuiltinFunction FUNCTIONS[] =
+	{
+		{ "+", [](long double a) { return a; }, Angle::None },
+		{ "-", [](long double a) { return -a; }, Angle::None },
+		{ "abs", [](long double a) { return std::abs(a); }, Angle::None },
+		{ "log2", [](long double a) { return std::log2(a); }, Angle::None },
+		{ "lg", [](long double a) { return std::log10(a); }, Angle::None },
+		{ "ln", [](long double a) { return std::log(a); }, Angle::None },
+		{ "sin", [](long double a) { return std::sin(a); }, Angle::Argument },
+		{ "cos", [](long double a) { return std::cos(a); }, Angle::Argument },
+		{ "tan", [](long double a) { return std::tan(a); }, Angle::Argument },
+		{ "asin", [](long double a) { return std::asin(a); }, Angle::Result },
+		{ "acos", [](long double a) { return std::acos(a); }, Angle::Result },
+		{ "atan", [](long double a) { return std::atan(a); }, Angle::Result },
+		{ "sqrt", [](long double a) { return std::sqrt(a); }, Angle::None },
+		{ "!", [](long double a) { return std::tgamma(a + 1.0L); }, Angle::None }
+	};
+
+	static constexpr BuiltinOperator OPERATORS[] =
+	{
+		{ "+", [](long double a, long double b) { return a + b; } },
+		{ "-", [](long double a, long double b) { return a - b; } },
+		{ "*", [](long double a, long double b) { return a * b; } },
+		{ "/", [](long double a, long double b) { return a / b; } },
+		{ "^", [](long double a, long double b) { return std::pow(a, b); } },
+		{ "%", [](long double a, long double b) { return (long double)((long int)a % (long int)b); } }
+	};
+
+};
+
+class Metrics
+{
+public:
+	enum class Counter
+	{
+		FormulasCompiled,
+		CacheHits,
+		CacheMisses,
+		CacheEvictions,
+		Evaluations,
+		RowsEvaluated,
+		CompileNanoseconds,
+		EvaluateNanoseconds,
+		TablesBuilt,
+		TableBytes,
+		Count
+	};
+
+	static constexpr size_t COUNTER_COUNT = (size_t)Counter::Count;
+	static constexpr size_t STATE_COUNT = (size_t)Parser::State::ReadFailed + 1;
+
+	struct Snapshot
+	{
+		uint64_t counters[COUNTER_COUNT] = {};
+		uint64_t errors[STATE_COUNT] = {};
+	};
+
+	class Scope
+	{
+	public:
+		Scope(const Parser::State& state, Counter time, Counter count, uint64_t amount = 1, uint64_t rows = 0);
+		~Scope();
+
+	private:
+		const Parser::State& m_State;
+		Counter m_Time;
+		std::chrono::steady_clock::time_point m_Start;
+	};
+
+	static void Add(Counter counter, uint64_t value = 1);
+	static void AddError(Parser::State state);
+
+	static Snapshot Read();
+	static std::string Format();
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+		std::atomic<uint64_t> errors[STATE_COUNT] = {};
+	};
+
+	struct Registration
+	{
+		Registration();
+		~Registration();
+
+		Slot* slot;
+	};
+
+	static Slot& GetSlot();
+
+	static std::mutex s_Mutex;
+	static std::vector<Slot*> s_Slots;
+	static Snapshot s_Retired;
+};
+
+class AsyncEvaluation
+{
+public:
+	AsyncEvaluation(Parser& parser, const Program& program, bool radians, const Parser::Columns& inputs,
+		std::span<const std::span<double>> outputs, std::stop_token stop, Parser::Resume resume);
+
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> caller);
+	Parser::State await_resume() const;
+
+private:
+	Parser& m_Parser;
+	Parser m_Worker;
+
+	const Program& m_Program;
+	bool m_Radians;
+	const Parser::Columns& m_Inputs;
+	std::span<const std::span<double>> m_Outputs;
+	std::stop_token m_Stop;
+	Parser::Resume m_Resume;
+
+	Parser::State m_State = Parser::State::Ok;
+};
+
+template <typename F>
+void Parser::AddOperator(std::string_view text, F&& handler)
+{
+	using Callable = std::decay_t<F>;
+
+	if constexpr (std::is_empty_v<Callable> && std::is_default_constructible_v<Callable>)
+		RegisterOperator(text, BinaryHandler(std::forward<F>(handler)), &ApplyBinaryKernel<Callable>);
+	else
+		RegisterOperator(text, BinaryHandler(std::forward<F>(handler)), nullptr);
+}
+
+template <typename F>
+void Parser::AddFunction(std::string_view text, F&& handler)
+{
+	using Callable = std::decay_t<F>;
+
+	if constexpr (std::is_invocable_v<Callable&, std::span<const double>, std::span<double>>)
+		RegisterFunction(text, {}, Kernel(std::forward<F>(handler)));
+	else if constexpr (std::is_empty_v<Callable> && std::is_default_constructible_v<Callable>)
+		RegisterFunction(text, UnaryHandler(std::forward<F>(handler)), &ApplyKernel<Callable>);
+	else
+		RegisterFunction(text, UnaryHandler(std::forward<F>(handler)), {});
+}
+
+template <typename F>
+void Parser::ApplyKernel(std::span<const double> in, std::span<double> out)
+{
+	F function;
+
+	for (size_t i = 0; i < in.size(); i++)
+		out[i] = (double)function((long double)in[i]);
+}
+
+template <typename F>
+void Parser::ApplyBinaryKernel(std::span<double> lhs, std::span<const double> rhs)
+{
+	F function;
+
+	for (size_t i = 0; i < lhs.size(); i++)
+		lhs[i] = (double)function((long double)lhs[i], (long double)rhs[i]);
+}
+
+#ifdef PARSER_IMPL
+#undef PARSER_IMPL
+
+
+Expression::Expression(const allocator_type& allocator) :
+	kinds(allocator), ops(allocator), firstChildren(allocator), values(allocator), symbols(allocator)
+{
+}
+
+Expression::Expression(const Expression& other, const allocator_type& allocator) :
+	kinds(other.kinds, allocator), ops(other.ops, allocator), firstChildren(other.firstChildren, allocator),
+	values(other.values, allocator), symbols(other.symbols, allocator), locals(other.locals)
+{
+}
+
+Expression::Expression(Expression&& other, const allocator_type& allocator) :
+	kinds(std::move(other.kinds), allocator), ops(std::move(other.ops), allocator), firstChildren(std::move(other.firstChildren), allocator),
+	values(std::move(other.values), allocator), symbols(std::move(other.symbols), allocator), locals(other.locals)
+{
+}
+
+Expression::allocator_type Expression::get_allocator() const
+{
+	return kinds.get_allocator();
+}
+
+uint32_t Expression::Push(Kind kind, uint32_t op, uint32_t firstChild, long double value)
+{
+	uint32_t node = (uint32_t)kinds.size();
+
+	kinds.push_back(kind);
+	ops.push_back(op);
+	firstChildren.push_back(kind == Kind::Binary || kind == Kind::Local ? firstChild : kind == Kind::Unary || kind == Kind::Let ? node - 1 : node);
+	values.push_back(kind == Kind::Let ? (long double)locals++ : value);
+
+	return node;
+}
+
+uint32_t Expression::Intern(std::string_view symbol)
+{
+	auto it = std::find(symbols.begin(), symbols.end(), symbol);
+
+	if (it != symbols.end())
+		return (uint32_t)(it - symbols.begin());
+
+	symbols.emplace_back(symbol);
+	return (uint32_t)symbols.size() - 1;
+}
+
+void Expression::Clear()
+{
+	kinds.clear();
+	ops.clear();
+	firstChildren.clear();
+	values.clear();
+	symbols.clear();
+
+	locals = 0;
+}
+
+void Expression::Truncate(size_t size)
+{
+	kinds.resize(size);
+	ops.resize(size);
+	firstChildren.resize(size);
+	values.resize(size);
+}
+
+size_t Expression::Size() const
+{
+	return kinds.size();
+}
+
+bool Expression::Empty() const
+{
+	return kinds.empty();
+}
+
+uint32_t Expression::Root() const
+{
+	return (uint32_t)kinds.size() - 1;
+}
+
+std::pmr::vector<uint8_t> Expression::Statements() const
+{
+	std::pmr::vector<uint8_t> statements(Size(), get_allocator());
+	std::pmr::vector<uint32_t> starts(Size(), get_allocator());
+
+	for (uint32_t node = 0; node < Size(); node++)
+		starts[node] = kinds[node] == Kind::Unary || kinds[node] == Kind::Binary || kinds[node] == Kind::Let ? starts[firstChildren[node]] : node;
+
+	for (uint32_t node = Root(); node < Size(); node = starts[node] - 1)
+	{
+		statements[node] = true;
+
+		if (starts[node] == 0)
+			break;
+	}
+
+	return statements;
+}
+
+Expression Expression::Canonicalize() const
+{
+	Expression result(get_allocator());
+
+	if (Empty())
+		return result;
+
+	std::pmr::vector<uint8_t> literals(get_allocator());
+	std::pmr::vector<long double> numbers(get_allocator());
+	std::pmr::vector<uint64_t> hashes = Hashes(&literals, &numbers);
+
+	// Inlining a let at every use is exponential in chains like let b = a + a, so lets used more than once
+	// are emitted once as statements and referenced through Local nodes.
+	std::pmr::vector<uint8_t> reachable(Size(), get_allocator());
+	std::pmr::vector<uint32_t> uses(Size(), get_allocator());
+	std::pmr::vector<uint32_t> shared(Size(), get_allocator());
+
+	reachable[Root()] = true;
+
+	for (uint32_t node = Root() + 1; node-- > 0;)
+	{
+		if (!reachable[node])
+			continue;
+
+		switch (kinds[node])
+		{
+		case Kind::Unary:
+		case Kind::Let: reachable[node - 1] = true; break;
+		case Kind::Binary: reachable[firstChildren[node]] = reachable[node - 1] = true; break;
+		case Kind::Local: reachable[firstChildren[node]] = true; uses[firstChildren[node]]++; break;
+		default: break;
+		}
+	}
+
+	auto emit = [&](auto& self, uint32_t node) -> uint32_t
+	{
+		while (kinds[node] == Kind::Let || kinds[node] == Kind::Local)
+		{
+			uint32_t let = kinds[node] == Kind::Let ? node : firstChildren[node];
+
+			if (shared[let])
+				return result.Push(Kind::Local, 0, shared[let]);
+
+			node = let - 1;
+		}
+
+		if (literals[node])
+			return result.Push(Kind::Number, 0, 0, numbers[node]);
+
+		const std::pmr::string& symbol = symbols[ops[node]];
+
+		switch (kinds[node])
+		{
+		case Kind::Name:
+			return result.Push(Kind::Name, result.Intern(symbol));
+
+		case Kind::Unary:
+			if (symbol == "+")
+				return self(self, node - 1);
+
+			self(self, node - 1);
+			return result.Push(Kind::Unary, result.Intern(symbol));
+
+		case Kind::Binary:
+		{
+			uint32_t lhs = firstChildren[node], rhs = node - 1;
+
+			if (IsCommutative(symbol) && hashes[rhs] < hashes[lhs])
+				std::swap(lhs, rhs);
+
+			uint32_t first = self(self, lhs);
+			self(self, rhs);
+
+			return result.Push(Kind::Binary, result.Intern(symbol), first);
+		}
+
+		default:
+			return result.Push(Kind::Number, 0, 0, values[node]);
+		}
+	};
+
+	for (uint32_t node = 0; node < Size(); node++)
+	{
+		if (kinds[node] == Kind::Let && uses[node] > 1 && !literals[node])
+		{
+			emit(emit, node - 1);
+			shared[node] = result.Push(Kind::Let);
+		}
+	}
+
+	emit(emit, Root());
+	return result;
+}
+
+uint64_t Expression::Hash() const
+{
+	return Empty() ? 0 : Hashes()[Root()];
+}
+
+std::pmr::vector<uint64_t> Expression::Hashes(std::pmr::vector<uint8_t>* literals, std::pmr::vector<long double>* numbers) const
+{
+	std::pmr::vector<uint64_t> hashes(Size(), get_allocator());
+	std::pmr::vector<uint8_t> folded(Size(), get_allocator());
+	std::pmr::vector<long double> folds(values, get_allocator());
+
+	auto mix = [](std::initializer_list<uint64_t> words)
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+
+		for (uint64_t word : words)
+		{
+			hash ^= word + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+			hash *= 0xff51afd7ed558ccdULL;
+		}
+
+		return hash;
+	};
+
+	auto text = [](std::string_view symbol)
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+
+		for (char c : symbol)
+			hash = (hash ^ (uint8_t)c) * 0x100000001b3ULL;
+
+		return hash;
+	};
+
+	auto number = [&](long double& value)
+	{
+		if (std::isnan(value))
+			value = std::numeric_limits<long double>::quiet_NaN();
+
+		if (!std::isfinite(value))
+			return mix({ (uint64_t)Kind::Number, std::isnan(value) ? 2ULL : value > 0.0L ? 1ULL : 3ULL });
+
+		int exponent = 0;
+		long double mantissa = std::frexp(std::fabs(value), &exponent);
+
+		return mix({ (uint64_t)Kind::Number, (uint64_t)std::ldexp(mantissa, 64), (uint64_t)(int64_t)exponent, (uint64_t)std::signbit(value) });
+	};
+
+	for (uint32_t node = 0; node < Size(); node++)
+	{
+		uint32_t child = firstChildren[node];
+
+		switch (kinds[node])
+		{
+		case Kind::Number:
+			folded[node] = true;
+			hashes[node] = number(folds[node]);
+			break;
+
+		case Kind::Name:
+			hashes[node] = mix({ (uint64_t)Kind::Name, text(symbols[ops[node]]) });
+			break;
+
+		case Kind::Unary:
+			folded[node] = folded[child] && (symbols[ops[node]] == "+" || symbols[ops[node]] == "-");
+
+			if (folded[node])
+			{
+				folds[node] = symbols[ops[node]] == "-" ? -folds[child] : folds[child];
+				hashes[node] = number(folds[node]);
+			}
+			else
+				hashes[node] = symbols[ops[node]] == "+" ? hashes[child] : mix({ (uint64_t)Kind::Unary, text(symbols[ops[node]]), hashes[child] });
+			break;
+
+		case Kind::Binary:
+		{
+			uint64_t lhs = hashes[child], rhs = hashes[node - 1];
+
+			if (IsCommutative(symbols[ops[node]]) && rhs < lhs)
+				std::swap(lhs, rhs);
+
+			hashes[node] = mix({ (uint64_t)Kind::Binary, text(symbols[ops[node]]), lhs, rhs });
+		}
+		break;
+
+		case Kind::Let:
+		case Kind::Local:
+			folded[node] = folded[child];
+			folds[node] = folds[child];
+			hashes[node] = hashes[child];
+			break;
+		}
+	}
+
+	if (literals)
+		*literals = std::move(folded);
+
+	if (numbers)
+		*numbers = std::move(folds);
+
+	return hashes;
+}
+
+bool Expression::IsCommutative(std::string_view symbol)
+{
+	return symbol == "+" || symbol == "*";
+}
+
+bool Expression::IsSameNumber(long double a, long double b)
+{
+	// Unlike ==, zeros of different sign differ (1 / -0 is not 1 / 0) and NaN matches NaN.
+	return std::signbit(a) == std::signbit(b) && (a == b || (std::isnan(a) && std::isnan(b)));
+}
+
+
+Graph::Graph(const allocator_type& allocator) :
+	kinds(allocator), ops(allocator), lhs(allocator), rhs(allocator), values(allocator),
+	symbols(allocator), roots(allocator), index(allocator)
+{
+}
+
+uint32_t Graph::Add(const Expression& expr)
+{
+	std::pmr::vector<uint32_t> nodeMap(kinds.get_allocator());
+	std::pmr::vector<uint32_t> symbolMap(kinds.get_allocator());
+
+	uint32_t root = Add(expr, nodeMap, symbolMap);
+	roots.push_back(root);
+
+	return root;
+}
+
+// Continues adding an expression that has grown since the last call: only nodes and symbols missing from the maps are
+// inserted, and the root is returned without being recorded in roots.
+uint32_t Graph::Add(const Expression& expr, std::pmr::vector<uint32_t>& nodeMap, std::pmr::vector<uint32_t>& symbolMap)
+{
+	for (size_t i = symbolMap.size(); i < expr.symbols.size(); i++)
+		symbolMap.push_back(Intern(expr.symbols[i]));
+
+	size_t first = nodeMap.size();
+	nodeMap.resize(expr.Size());
+
+	for (uint32_t node = (uint32_t)first; node < expr.Size(); node++)
+	{
+		Kind kind = expr.kinds[node];
+		uint32_t op = kind == Kind::Number ? 0 : symbolMap[expr.ops[node]];
+
+		switch (kind)
+		{
+		case Kind::Number: nodeMap[node] = Insert(kind, 0, 0, 0, expr.values[node]); break;
+		case Kind::Name: nodeMap[node] = Insert(kind, op, 0, 0, 0.0L); break;
+		case Kind::Unary: nodeMap[node] = Insert(kind, op, nodeMap[node - 1], 0, 0.0L); break;
+		case Kind::Binary: nodeMap[node] = Insert(kind, op, nodeMap[expr.firstChildren[node]], nodeMap[node - 1], 0.0L); break;
+		case Kind::Let: nodeMap[node] = nodeMap[node - 1]; break;
+		case Kind::Local: nodeMap[node] = nodeMap[expr.firstChildren[node]]; break;
+		}
+	}
+
+	return nodeMap[expr.Root()];
+}
+
+uint32_t Graph::Insert(Kind kind, uint32_t op, uint32_t lhs, uint32_t rhs, long double value)
+{
+	uint64_t hash = Hash(kind, op, lhs, rhs, value);
+	auto [first, last] = index.equal_range(hash);
+
+	for (auto it = first; it != last; it++)
+	{
+		uint32_t node = it->second;
+
+		if (kinds[node] == kind && ops[node] == op && this->lhs[node] == lhs && this->rhs[node] == rhs && Expression::IsSameNumber(values[node], value))
+			return node;
+	}
+
+	uint32_t node = (uint32_t)kinds.size();
+
+	kinds.push_back(kind);
+	ops.push_back(op);
+	this->lhs.push_back(lhs);
+	this->rhs.push_back(rhs);
+	values.push_back(value);
+
+	index.insert({ hash, node });
+
+	return node;
+}
+
+uint32_t Graph::Intern(std::string_view symbol)
+{
+	auto it = std::find(symbols.begin(), symbols.end(), symbol);
+
+	if (it != symbols.end())
+		return (uint32_t)(it - symbols.begin());
+
+	symbols.emplace_back(symbol);
+	return (uint32_t)symbols.size() - 1;
+}
+
+size_t Graph::Size() const
+{
+	return kinds.size();
+}
+
+uint64_t Graph::Hash(Kind kind, uint32_t op, uint32_t lhs, uint32_t rhs, long double value)
+{
+	double number = (double)value;
+	uint64_t bits;
+	std::memcpy(&bits, &number, sizeof(bits));
+
+	uint64_t hash = (uint64_t)kind;
+
+	for (uint64_t word : { (uint64_t)op, (uint64_t)lhs, (uint64_t)rhs, bits })
+	{
+		hash ^= word + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		hash *= 0xff51afd7ed558ccdULL;
+	}
+
+	return hash;
+}
+
+
+
+Program::Program(const allocator_type& allocator) : code(allocator), symbols(allocator), outputs(allocator), tables(allocator)
+{
+}
+
+bool Program::Instruction::operator==(const Instruction& other) const
+{
+	return kind == other.kind && op == other.op && target == other.target && lhs == other.lhs && rhs == other.rhs &&
+		Expression::IsSameNumber(value, other.value) && knownBase == other.knownBase && knownExponent == other.knownExponent && table == other.table;
+}
+
+
+std::mutex Metrics::s_Mutex;
+std::vector<Metrics::Slot*> Metrics::s_Slots;
+Metrics::Snapshot Metrics::s_Retired;
+
+Metrics::Scope::Scope(const Parser::State& state, Counter time, Counter count, uint64_t amount, uint64_t rows) :
+	m_State(state), m_Time(time)
+{
+#ifndef PARSER_NO_METRICS
+	Add(count, amount);
+	Add(Counter::RowsEvaluated, rows);
+
+	m_Start = std::chrono::steady_clock::now();
+#endif
+}
+
+Metrics::Scope::~Scope()
+{
+#ifndef PARSER_NO_METRICS
+	Add(m_Time, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count());
+
+	if (m_State != Parser::State::Ok)
+		AddError(m_State);
+#endif
+}
+
+// Each thread only writes its own slot, so a plain load and store is enough; readers sum all slots.
+void Metrics::Add(Counter counter, uint64_t value)
+{
+#ifndef PARSER_NO_METRICS
+	std::atomic<uint64_t>& slot = GetSlot().counters[(size_t)counter];
+	slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+#endif
+}
+
+void Metrics::AddError(Parser::State state)
+{
+#ifndef PARSER_NO_METRICS
+	std::atomic<uint64_t>& slot = GetSlot().errors[(size_t)state];
+	slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+}
+
+Metrics::Snapshot Metrics::Read()
+{
+	std::lock_guard lock(s_Mutex);
+	Snapshot snapshot = s_Retired;
+
+	for (const Slot* slot : s_Slots)
+	{
+		for (size_t i = 0; i < COUNTER_COUNT; i++)
+			snapshot.counters[i] += slot->counters[i].load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i < STATE_COUNT; i++)
+			snapshot.errors[i] += slot->errors[i].load(std::memory_order_relaxed);
+	}
+
+	return snapshot;
+}
+
+std::string Metrics::Format()
+{
+	static constexpr std::string_view COUNTERS[][2] =
+	{
+		{ "formulas_compiled_total", "Formulas compiled into programs." },
+		{ "cache_hits_total", "Compiled formula cache hits." },
+		{ "cache_misses_total", "Compiled formula cache misses." },
+		{ "cache_evictions_total", "Compiled formulas evicted from the cache." },
+		{ "evaluations_total", "Evaluation calls." },
+		{ "rows_evaluated_total", "Rows evaluated." },
+		{ "compile_seconds_total", "Time spent compiling." },
+		{ "evaluate_seconds_total", "Time spent evaluating." },
+		{ "lookup_tables_built_total", "Lookup tables built for approximated call sites." },
+		{ "lookup_table_bytes_total", "Bytes allocated for lookup tables." }
+	};
+
+	static constexpr std::string_view STATES[] =
+	{
+		"ok", "invalid_syntax", "unknown_binary_operator", "unknown_unary_operator", "unknown_expression_type", "invalid_input", "cancelled", "read_failed"
+	};
+
+	Snapshot snapshot = Read();
+	std::string text;
+
+	for (size_t i = 0; i < COUNTER_COUNT; i++)
+	{
+		std::string name = "mathparser_" + std::string(COUNTERS[i][0]);
+		bool seconds = i == (size_t)Counter::CompileNanoseconds || i == (size_t)Counter::EvaluateNanoseconds;
+
+		text += "# HELP " + name + " " + std::string(COUNTERS[i][1]) + "\n";
+		text += "# TYPE " + name + " counter\n";
+		text += name + " " + (seconds ? std::to_string(snapshot.counters[i] * 1e-9) : std::to_string(snapshot.counters[i])) + "\n";
+	}
+
+	text += "# HELP mathparser_errors_total Failed parses and evaluations by state.\n";
+	text += "# TYPE mathparser_errors_total counter\n";
+
+	for (size_t i = 1; i < STATE_COUNT; i++)
+		text += "mathparser_errors_total{state=\"" + std::string(STATES[i]) + "\"} " + std::to_string(snapshot.errors[i]) + "\n";
+
+	return text;
+}
+
+Metrics::Registration::Registration() : slot(new Slot)
+{
+	std::lock_guard lock(s_Mutex);
+	s_Slots.push_back(slot);
+}
+
+Metrics::Registration::~Registration()
+{
+	std::lock_guard lock(s_Mutex);
+
+	for (size_t i = 0; i < COUNTER_COUNT; i++)
+		s_Retired.counters[i] += slot->counters[i].load(std::memory_order_relaxed);
+
+	for (size_t i = 0; i < STATE_COUNT; i++)
+		s_Retired.errors[i] += slot->errors[i].load(std::memory_order_relaxed);
+
+	std::erase(s_Slots, slot);
+	delete slot;
+}
+
+Metrics::Slot& Metrics::GetSlot()
+{
+	thread_local Registration registration;
+	return *registration.slot;
+}
+
+
+AlignedResource::AlignedResource(std::pmr::memory_resource* upstream, bool hugePages) : m_Upstream(upstream), m_HugePages(hugePages)
+{
+}
+
+AlignedResource* AlignedResource::Shared()
+{
+	static AlignedResource resource;
+	return &resource;
+}
+
+void* AlignedResource::do_allocate(size_t bytes, size_t alignment)
+{
+#ifdef __linux__
+	if (IsHuge(bytes))
+	{
+		// Maps one extra huge page and trims both ends so the block starts on a huge page boundary.
+		size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void* mapping = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED)
+			throw std::bad_alloc();
+
+		uintptr_t begin = (uintptr_t)mapping;
+		uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+		if (aligned > begin)
+			munmap(mapping, aligned - begin);
+
+		if (aligned + size < begin + size + HUGE_PAGE_SIZE)
+			munmap((void*)(aligned + size), begin + HUGE_PAGE_SIZE - aligned);
+
+		madvise((void*)aligned, size, MADV_HUGEPAGE);
+		return (void*)aligned;
+	}
+#endif
+
+	return m_Upstream->allocate(bytes, std::max(alignment, CACHE_LINE));
+}
+
+void AlignedResource::do_deallocate(void* pointer, size_t bytes, size_t alignment)
+{
+#ifdef __linux__
+	if (IsHuge(bytes))
+	{
+		munmap(pointer, (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+		return;
+	}
+#endif
+
+	m_Upstream->deallocate(pointer, bytes, std::max(alignment, CACHE_LINE));
+}
+
+bool AlignedResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	const AlignedResource* resource = dynamic_cast<const AlignedResource*>(&other);
+	return resource && resource->m_HugePages == m_HugePages && resource->m_Upstream->is_equal(*m_Upstream);
+}
+
+bool AlignedResource::IsHuge(size_t bytes) const
+{
+	return m_HugePages && bytes >= HUGE_PAGE_SIZE;
+}
+
+
+FixedPoint::FixedPoint(unsigned integerBits, unsigned fractionBits)
+{
+	m_FractionBits = std::min(fractionBits, 61u);
+	m_IntegerBits = std::min(integerBits, 62u - m_FractionBits);
+
+	m_Max = (int64_t(1) << (m_IntegerBits + m_FractionBits)) - 1;
+	m_Min = -m_Max - 1;
+}
+
+int64_t FixedPoint::FromDouble(double value)
+{
+	if (std::isnan(value))
+	{
+		m_Saturations++;
+		return 0;
+	}
+
+	double scaled = std::ldexp(value, (int)m_FractionBits);
+
+	if (scaled >= (double)m_Max || scaled <= (double)m_Min)
+		return Saturate(scaled > 0.0 ? (Wide)m_Max + 1 : (Wide)m_Min - 1);
+
+	return std::llround(scaled);
+}
+
+double FixedPoint::ToDouble(int64_t value) const
+{
+	return std::ldexp((double)value, -(int)m_FractionBits);
+}
+
+int64_t FixedPoint::Add(int64_t a, int64_t b)
+{
+	return Saturate((Wide)a + b);
+}
+
+int64_t FixedPoint::Subtract(int64_t a, int64_t b)
+{
+	return Saturate((Wide)a - b);
+}
+
+int64_t FixedPoint::Multiply(int64_t a, int64_t b)
+{
+	if (m_FractionBits == 0)
+		return Saturate((Wide)a * b);
+
+	return Saturate(((Wide)a * b + (Wide(1) << (m_FractionBits - 1))) >> m_FractionBits);
+}
+
+int64_t FixedPoint::Divide(int64_t a, int64_t b)
+{
+	if (b == 0)
+		return Saturate(a > 0 ? (Wide)m_Max + 1 : a < 0 ? (Wide)m_Min - 1 : 0);
+
+	return Saturate(((Wide)a << m_FractionBits) / b);
+}
+
+int64_t FixedPoint::Modulo(int64_t a, int64_t b)
+{
+	int64_t divisor = b / (int64_t(1) << m_FractionBits);
+
+	if (divisor == 0)
+		return Saturate((Wide)m_Max + 1);
+
+	return Saturate((Wide)(a / (int64_t(1) << m_FractionBits) % divisor) << m_FractionBits);
+}
+
+int64_t FixedPoint::Power(int64_t a, int64_t b)
+{
+	int64_t mask = (int64_t(1) << m_FractionBits) - 1;
+	int64_t one = int64_t(1) << m_FractionBits;
+
+	if ((b & mask) == 0)
+	{
+		int64_t exponent = b >> m_FractionBits;
+		int64_t result = one;
+		int64_t base = a;
+
+		for (int64_t n = exponent < 0 ? -exponent : exponent; n > 0; n >>= 1)
+		{
+			if (n & 1)
+				result = Multiply(result, base);
+
+			if (n > 1)
+				base = Multiply(base, base);
+		}
+
+		return exponent < 0 ? Divide(one, result) : result;
+	}
+
+	if (a <= 0)
+	{
+		if (a < 0)
+			m_Saturations++;
+
+		return 0;
+	}
+
+	int exponent;
+	int64_t mantissa = Logarithm(a, exponent);
+
+	return Exp(Multiply(Narrow((Wide)exponent * LN2 + mantissa), b));
+}
+
+bool FixedPoint::Call(std::string_view function, int64_t a, int64_t& result)
+{
+	int exponent;
+
+	if (function == "+") result = a;
+	else if (function == "-") result = Saturate(-(Wide)a);
+	else if (function == "abs") result = Saturate(a < 0 ? -(Wide)a : a);
+	else if (function == "sqrt") result = Sqrt(a);
+	else if (function == "sin") result = Sin(Widen(a));
+	else if (function == "cos") result = Sin(Widen(a) + PI / 2);
+	else if (function == "asin") result = Asin(a);
+	else if (function == "acos") result = Narrow(PI / 2 - (Wide)Widen(Asin(a)));
+	else if (function == "atan") result = Atan(Widen(a));
+	else if (function == "!") result = Factorial(a);
+	else if (function == "tan")
+	{
+		int64_t cosine = Sin(Widen(a) + PI / 2);
+		result = Divide(Sin(Widen(a)), cosine);
+	}
+	else if (function == "ln" || function == "log2" || function == "lg")
+	{
+		if (a <= 0)
+		{
+			result = Saturate((Wide)m_Min - 1);
+			return true;
+		}
+
+		int64_t mantissa = Logarithm(a, exponent);
+
+		if (function == "ln")
+			result = Narrow((Wide)exponent * LN2 + mantissa);
+		else if (function == "log2")
+			result = Narrow(((Wide)exponent << 61) + ((Wide)mantissa << 61) / LN2);
+		else
+			result = Narrow((Wide)exponent * LOG10_2 + ((Wide)mantissa << 61) / LN10);
+	}
+	else
+		return false;
+
+	return true;
+}
+
+int64_t FixedPoint::ToRadians(int64_t degrees)
+{
+	return Saturate(((Wide)degrees * (PI / 180) + (Wide(1) << 60)) >> 61);
+}
+
+int64_t FixedPoint::ToDegrees(int64_t radians)
+{
+	// 180 / pi in Q58 so that the product stays within 128 bits.
+	static constexpr Wide DEGREES = (Wide(180) << 119) / PI;
+	return Saturate(((Wide)radians * DEGREES + (Wide(1) << 57)) >> 58);
+}
+
+unsigned FixedPoint::GetIntegerBits() const
+{
+	return m_IntegerBits;
+}
+
+unsigned FixedPoint::GetFractionBits() const
+{
+	return m_FractionBits;
+}
+
+size_t FixedPoint::GetSaturations() const
+{
+	return m_Saturations;
+}
+
+int64_t FixedPoint::Saturate(Wide value)
+{
+	if (value > m_Max || value < m_Min)
+	{
+		m_Saturations++;
+		return value > m_Max ? m_Max : m_Min;
+	}
+
+	return (int64_t)value;
+}
+
+int64_t FixedPoint::Narrow(Wide value)
+{
+	unsigned shift = 61 - m_FractionBits;
+	return Saturate(shift == 0 ? value : (value + (Wide(1) << (shift - 1))) >> shift);
+}
+
+FixedPoint::Wide FixedPoint::Widen(int64_t value) const
+{
+	return (Wide)value << (61 - m_FractionBits);
+}
+
+int64_t FixedPoint::Sqrt(int64_t a)
+{
+	if (a < 0)
+	{
+		m_Saturations++;
+		return 0;
+	}
+
+	return Saturate(SquareRoot((Wide)a << m_FractionBits));
+}
+
+FixedPoint::Wide FixedPoint::SquareRoot(Wide value)
+{
+	Wide result = 0;
+	Wide bit = Wide(1) << 124;
+
+	while (bit > value)
+		bit >>= 2;
+
+	for (; bit != 0; bit >>= 2)
+	{
+		if (value >= result + bit)
+		{
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+			result >>= 1;
+	}
+
+	return result;
+}
+
+int64_t FixedPoint::Exp(int64_t a)
+{
+	// e^a = 2^k * e^r with |r| <= ln(2) / 2, and e^r from its Taylor series.
+	Wide x = Widen(a);
+	Wide k = (x + (x < 0 ? -LN2 / 2 : LN2 / 2)) / LN2;
+
+	if (k > 63)
+		return Saturate((Wide)m_Max + 1);
+
+	if (k < -63 - (Wide)m_FractionBits)
+		return 0;
+
+	int64_t r = (int64_t)(x - k * LN2);
+	int64_t term = ONE;
+	Wide sum = ONE;
+
+	for (int64_t n = 1; term != 0; n++)
+	{
+		term = (int64_t)(((Wide)term * r >> 61) / n);
+		sum += term;
+	}
+
+	int shift = (int)(int64_t)k - (61 - (int)m_FractionBits);
+
+	if (shift >= 0)
+		return Saturate(sum > ((Wide)m_Max >> shift) ? (Wide)m_Max + 1 : sum << shift);
+
+	return Saturate((sum + (Wide(1) << (-shift - 1))) >> -shift);
+}
+
+int64_t FixedPoint::Sin(Wide a)
+{
+	// Reduces to [-pi/2, pi/2] and sums the Taylor series.
+	Wide turns = (a + (a < 0 ? -(Wide)PI : (Wide)PI)) / (2 * (Wide)PI);
+	int64_t x = (int64_t)(a - turns * 2 * PI);
+
+	if (x > PI / 2)
+		x = PI - x;
+	else if (x < -PI / 2)
+		x = -PI - x;
+
+	int64_t square = (int64_t)((Wide)x * x >> 61);
+	int64_t term = x;
+	Wide sum = x;
+
+	for (int64_t n = 1; term != 0; n++)
+	{
+		term = (int64_t)(-((Wide)term * square >> 61) / (2 * n * (2 * n + 1)));
+		sum += term;
+	}
+
+	return Narrow(sum);
+}
+
+int64_t FixedPoint::Atan(Wide a)
+{
+	// atan(x) = pi/2 - atan(1/x) above one and pi/6 + atan((sqrt(3)x - 1) / (sqrt(3) + x)) above tan(pi/12),
+	// leaving an argument small enough for the Taylor series.
+	bool negative = a < 0;
+	Wide x = negative ? -a : a;
+	Wide offset = 0;
+
+	if (x > ONE)
+	{
+		x = ((Wide)ONE << 61) / x;
+		offset = PI / 2;
+	}
+
+	Wide shifted = 0;
+
+	if (x > TAN_PI_12)
+	{
+		x = (((Wide)SQRT3 * x >> 61) - ONE) * ONE / (SQRT3 + x);
+		shifted = PI / 6;
+	}
+
+	int64_t square = (int64_t)(x * x >> 61);
+	int64_t term = (int64_t)x;
+	Wide sum = x;
+
+	for (int64_t n = 1; term != 0; n++)
+	{
+		term = (int64_t)(-((Wide)term * square >> 61));
+		sum += term / (2 * n + 1);
+	}
+
+	sum += shifted;
+
+	if (offset != 0)
+		sum = offset - sum;
+
+	return Narrow(negative ? -sum : sum);
+}
+
+int64_t FixedPoint::Asin(int64_t a)
+{
+	int64_t one = int64_t(1) << m_FractionBits;
+
+	if (a > one || a < -one)
+	{
+		m_Saturations++;
+		a = a > 0 ? one : -one;
+	}
+
+	Wide x = Widen(a);
+	Wide root = SquareRoot(((Wide)ONE - x) * ((Wide)ONE + x));
+
+	if (root == 0)
+		return Narrow(a > 0 ? PI / 2 : -PI / 2);
+
+	return Atan((x << 61) / root);
+}
+
+int64_t FixedPoint::Factorial(int64_t a)
+{
+	// Gamma(1 + f) on [0, 1] from a polynomial (Abramowitz and Stegun 6.1.36, error below 3e-7), then the
+	// recurrence Gamma(1 + a) = a Gamma(a) to reach the integer part.
+	int64_t one = int64_t(1) << m_FractionBits;
+	int64_t whole = a >> m_FractionBits;
+	int64_t fraction = a - (whole << m_FractionBits);
+
+	Wide f = Widen(fraction);
+	Wide polynomial = 0;
+
+	for (size_t i = std::size(GAMMA); i-- > 0;)
+		polynomial = (polynomial * f >> 61) + (Wide)std::llround(std::ldexp(GAMMA[i], 61));
+
+	int64_t result = Narrow(polynomial);
+
+	for (int64_t i = 1; i <= whole && result != m_Max; i++)
+		result = Multiply(result, Add(fraction, i * one));
+
+	for (int64_t i = 0; i > whole; i--)
+	{
+		int64_t factor = fraction + i * one;
+
+		if (factor == 0)
+			return Saturate((Wide)m_Max + 1);
+
+		result = Divide(result, factor);
+	}
+
+	return result;
+}
+
+int64_t FixedPoint::Logarithm(int64_t a, int& exponent)
+{
+	// a = 2^e * m with m in [1, 2); ln(m) = 2 atanh((m - 1) / (m + 1)) from its series. Returns ln(m) in Q2.61.
+	int top = 63;
+
+	while (top > 0 && !((a >> top) & 1))
+		top--;
+
+	exponent = top - (int)m_FractionBits;
+
+	int64_t m = top <= 61 ? a << (61 - top) : a >> (top - 61);
+	int64_t t = (int64_t)(((Wide)(m - ONE) << 61) / ((Wide)m + ONE));
+	int64_t square = (int64_t)((Wide)t * t >> 61);
+
+	int64_t term = t;
+	Wide sum = t;
+
+	for (int64_t n = 1; term != 0; n++)
+	{
+		term = (int64_t)((Wide)term * square >> 61);
+		sum += term / (2 * n + 1);
+	}
+
+	return (int64_t)(2 * sum);
+}
+
+
+thread_local WorkerPool* WorkerPool::s_Current = nullptr;
+
+WorkerPool::WorkerPool(unsigned threads, bool pinned)
+{
+	std::vector<std::vector<int>> topology = GetTopology();
+	std::vector<std::pair<unsigned, int>> placement = Place(topology, threads);
+
+	for (std::vector<int>& cpus : topology)
+		m_Nodes.emplace_back().cpus = std::move(cpus);
+
+	if (m_Nodes.empty())
+		m_Nodes.emplace_back();
+
+	for (auto [node, cpu] : placement)
+		m_Nodes[node].threads++;
+
+	for (auto [node, cpu] : placement)
+		m_Threads.emplace_back(&WorkerPool::Run, this, node, cpu, pinned);
+}
+
+// Each thread goes to the node with the fewest threads per CPU once it is added, so nodes fill in proportion to their
+// size however few threads there are. Within a node, threads take its CPUs in turn.
+std::vector<std::pair<unsigned, int>> WorkerPool::Place(const std::vector<std::vector<int>>& topology, unsigned threads)
+{
+	std::vector<std::pair<unsigned, int>> placement;
+	std::vector<size_t> counts(topology.size());
+
+	for (unsigned i = 0; i < std::max(threads, 1u); i++)
+	{
+		size_t best = topology.size();
+
+		for (size_t node = 0; node < topology.size(); node++)
+		{
+			if (topology[node].empty())
+				continue;
+
+			if (best == topology.size() || (counts[node] + 1) * topology[best].size() < (counts[best] + 1) * topology[node].size())
+				best = node;
+		}
+
+		if (best == topology.size())
+			placement.emplace_back(0, -1);
+		else
+			placement.emplace_back((unsigned)best, topology[best][counts[best]++ % topology[best].size()]);
+	}
+
+	return placement;
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard lock(m_Mutex);
+		m_Stopping = true;
+	}
+
+	m_Ready.notify_all();
+
+	for (std::thread& thread : m_Threads)
+		thread.join();
+}
+
+void WorkerPool::Submit(std::function<void()> job, unsigned node)
+{
+	{
+		std::lock_guard lock(m_Mutex);
+		m_Nodes[node % m_Nodes.size()].jobs.push_back(std::move(job));
+	}
+
+	m_Ready.notify_one();
+}
+
+void WorkerPool::ForEach(size_t count, const std::function<void(size_t, size_t)>& job)
+{
+	// Rows are split into one contiguous range per node, sized by its thread count, and each range into chunks
+	// queued on that node. The split depends only on the count, so buffers touched through Touch are
+	// evaluated by the node that owns their pages. Node ranges start on a multiple of CHUNK_SIZE, so chunk
+	// boundaries never depend on the thread count or topology.
+	struct Chunk
+	{
+		size_t offset;
+		size_t count;
+		unsigned node;
+	};
+
+	std::vector<Chunk> chunks;
+
+	size_t threads = m_Threads.size();
+	size_t before = 0;
+
+	for (unsigned node = 0; node < m_Nodes.size(); node++)
+	{
+		size_t begin = count * before / threads / CHUNK_SIZE * CHUNK_SIZE;
+		before += m_Nodes[node].threads;
+		size_t end = before == threads ? count : count * before / threads / CHUNK_SIZE * CHUNK_SIZE;
+
+		for (size_t offset = begin; offset < end; offset += CHUNK_SIZE)
+			chunks.push_back({ offset, std::min(CHUNK_SIZE, end - offset), node });
+	}
+
+	// A job that fans out again would wait on threads that may all be waiting too, so it runs its chunks itself.
+	if (s_Current == this)
+	{
+		for (const Chunk& chunk : chunks)
+			job(chunk.offset, chunk.count);
+
+		return;
+	}
+
+	std::latch done((ptrdiff_t)chunks.size());
+
+	{
+		std::lock_guard lock(m_Mutex);
+
+		for (const Chunk& chunk : chunks)
+		{
+			m_Nodes[chunk.node].jobs.push_back([&job, &done, chunk]()
+			{
+				job(chunk.offset, chunk.count);
+				done.count_down();
+			});
+		}
+	}
+
+	m_Ready.notify_all();
+	done.wait();
+}
+
+void WorkerPool::Touch(std::span<double> buffer)
+{
+	ForEach(buffer.size(), [buffer](size_t offset, size_t count)
+	{
+		std::fill_n(buffer.begin() + offset, count, 0.0);
+	});
+}
+
+unsigned WorkerPool::GetThreadCount() const
+{
+	return (unsigned)m_Threads.size();
+}
+
+unsigned WorkerPool::GetNodeCount() const
+{
+	return (unsigned)m_Nodes.size();
+}
+
+WorkerPool& WorkerPool::Shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+std::vector<std::vector<int>> WorkerPool::GetTopology()
+{
+	std::vector<std::vector<int>> nodes;
+
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return nodes;
+
+	for (int node = 0;; node++)
+	{
+		char path[64];
+		std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+		FILE* file = std::fopen(path, "r");
+
+		if (!file)
+			break;
+
+		char list[4096] = {};
+		std::fgets(list, sizeof(list), file);
+		std::fclose(file);
+
+		std::vector<int> cpus;
+
+		// The list looks like "0-7,16-23".
+		for (char* cursor = list; *cursor >= '0' && *cursor <= '9';)
+		{
+			long first = std::strtol(cursor, &cursor, 10);
+			long last = *cursor == '-' ? std::strtol(cursor + 1, &cursor, 10) : first;
+
+			for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+				if (CPU_ISSET(cpu, &allowed))
+					cpus.push_back((int)cpu);
+
+			if (*cursor == ',')
+				cursor++;
+		}
+
+		if (!cpus.empty())
+			nodes.push_back(std::move(cpus));
+	}
+
+	if (nodes.empty())
+	{
+		nodes.emplace_back();
+
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed))
+				nodes[0].push_back(cpu);
+	}
+#endif
+
+	if (nodes.empty())
+		nodes.emplace_back();
+
+	return nodes;
+}
+
+void WorkerPool::Run(unsigned node, int cpu, bool pinned)
+{
+#ifdef __linux__
+	// Unpinned threads still stay on their node, so the per-node ranges of ForEach and Touch keep their pages local.
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	if (pinned && cpu >= 0)
+		CPU_SET(cpu, &set);
+	else if (m_Nodes.size() > 1)
+	{
+		for (int nodeCpu : m_Nodes[node].cpus)
+			CPU_SET(nodeCpu, &set);
+	}
+
+	if (CPU_COUNT(&set) > 0)
+		sched_setaffinity(0, sizeof(set), &set);
+#endif
+
+	s_Current = this;
+
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock lock(m_Mutex);
+			m_Ready.wait(lock, [&]() { return Take(node, job) || m_Stopping; });
+
+			if (!job)
+				return;
+		}
+
+		job();
+	}
+}
+
+bool WorkerPool::Take(unsigned node, std::function<void()>& job)
+{
+	// The thread's own node comes first, then the others in order, so work crosses sockets only when its node is idle.
+	for (size_t i = 0; i < m_Nodes.size(); i++)
+	{
+		std::deque<std::function<void()>>& jobs = m_Nodes[(node + i) % m_Nodes.size()].jobs;
+
+		if (!jobs.empty())
+		{
+			job = std::move(jobs.front());
+			jobs.pop_front();
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+AsyncEvaluation::AsyncEvaluation(Parser& parser, const Program& program, bool radians, const Parser::Columns& inputs,
+	std::span<const std::span<double>> outputs, std::stop_token stop, Parser::Resume resume) :
+	m_Parser(parser), m_Program(program), m_Radians(radians), m_Inputs(inputs), m_Outputs(outputs), m_Stop(std::move(stop)),
+	m_Resume(std::move(resume))
+{
+}
+
+bool AsyncEvaluation::await_ready()
+{
+	size_t rows = m_Outputs.empty() ? 0 : m_Outputs[0].size();
+
+	if (rows > Parser::ASYNC_INLINE_ROWS && !m_Stop.stop_requested())
+		return false;
+
+	m_Parser.Evaluate(m_Program, m_Radians, m_Inputs, m_Outputs, m_Stop);
+	m_State = m_Parser.GetState();
+
+	return true;
+}
+
+void AsyncEvaluation::await_suspend(std::coroutine_handle<> caller)
+{
+	// The worker gets its own parser state and a thread-safe resource. Without a resume hook, the caller resumes on
+	// the worker thread, where nested pool work runs inline.
+	m_Worker = m_Parser;
+	m_Worker.SetResource(std::pmr::new_delete_resource());
+
+	WorkerPool::Shared().Submit([this, caller]()
+	{
+		m_Worker.Evaluate(m_Program, m_Radians, m_Inputs, m_Outputs, m_Stop);
+		m_State = m_Worker.GetState();
+
+		if (m_Resume)
+			m_Resume(caller);
+		else
+			caller.resume();
+	});
+}
+
+Parser::State AsyncEvaluation::await_resume() const
+{
+	return m_State;
+}
+
+
+Document::Document(const allocator_type& allocator) :
+	text(allocator), expr(allocator), groups(allocator), values(allocator), dirty(allocator)
+{
+}
+
+void Document::Invalidate()
+{
+	std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+
+
+std::atomic<uint64_t> Parser::s_Generation = 0;
+
+Parser::Parser(std::pmr::memory_resource* resource) : m_Resource(resource)
+{
+
+}
+
+
+Parser::~Parser()
+{
+}
+
+
+long double Parser::Get(std::string_view input, bool radians)
+{
+	Expression expr = Parse(input);
+
+	if (!IsOk() || expr.Empty())
+		return 0.0;
+
+	return Evaluate(expr, radians);
+}
+
+
+bool Parser::Get(std::string_view input, bool radians, const Columns& inputs, std::span<double> output)
+{
+	Expression expr = Parse(input);
+
+	if (!IsOk())
+		return false;
+
+	if (expr.Empty())
+	{
+		std::fill(output.begin(), output.end(), 0.0);
+		return true;
+	}
+
+	return Evaluate(expr, radians, inputs, output);
+}
+
+
+Expression Parser::Parse(std::string_view text)
+{
+	std::pmr::string input(text, m_Resource);
+
+	for (auto& c : input)
+	{
+		if (isalpha(c))
+			c = tolower(c);
+	}
+
+	m_Input = input.data();
+	m_Begin = input.data();
+
+	return ParseStatements();
+}
+
+
+Expression Parser::Parse(const Reader& reader)
+{
+	std::pmr::string buffer(m_Resource);
+
+	m_Reader = &reader;
+	m_Buffer = &buffer;
+	m_Consumed = 0;
+
+	m_Input = buffer.data();
+	m_Begin = buffer.data();
+
+	Expression result = ParseStatements();
+
+	m_Reader = nullptr;
+	m_Buffer = nullptr;
+
+	return result;
+}
+
+
+Program Parser::Compile(const Reader& reader)
+{
+	Graph graph(m_Resource);
+	std::pmr::string buffer(m_Resource);
+
+	m_Reader = &reader;
+	m_Buffer = &buffer;
+	m_Consumed = 0;
+
+	m_Input = buffer.data();
+	m_Begin = buffer.data();
+
+	ParseStatements(&graph);
+
+	m_Reader = nullptr;
+	m_Buffer = nullptr;
+
+	if (!IsOk() || graph.roots.empty())
+		return Program(m_Resource);
+
+	return Compile(graph);
+}
+
+
+Program Parser::Compile(int fd)
+{
+	return Compile(Reader([fd](std::span<char> chunk)
+	{
+#ifdef _WIN32
+		int count = _read(fd, chunk.data(), (unsigned)chunk.size());
+		return count >= 0 ? (size_t)count : READ_FAILED;
+#else
+		ssize_t count;
+
+		do
+			count = read(fd, chunk.data(), chunk.size());
+		while (count < 0 && errno == EINTR);
+#endif
+		return count >= 0 ? (size_t)count : READ_FAILED;
+	}));
+}
+
+
+Expression Parser::ParseStatements(Graph* graph)
+{
+	m_State = State::Ok;
+	m_ReadFailed = false;
+
+	std::pmr::vector<Local> locals(m_Resource);
+	m_Locals = &locals;
+
+	// Definitions only reach the registry once the whole formula has parsed.
+	Table<Definition> definitions;
+	m_Definitions = &definitions;
+
+	Expression result(m_Resource);
+
+	// With a graph, each statement is hash-consed as soon as it is parsed and its nodes are dropped. Only a
+	// placeholder per let stays behind, mapped to the graph node of its value, for later statements to refer to.
+	std::pmr::vector<uint32_t> nodeMap(m_Resource);
+	std::pmr::vector<uint32_t> symbolMap(m_Resource);
+	size_t placeholders = 0;
+	uint32_t root = 0;
+	bool rooted = false;
+
+	while (IsOk())
+	{
+		size_t known = locals.size();
+		ParseStatement(result);
+
+		if (graph && IsOk() && result.Size() > placeholders)
+		{
+			root = graph->Add(result, nodeMap, symbolMap);
+			rooted = true;
+
+			for (size_t i = known; i < locals.size(); i++)
+				locals[i].node = nodeMap[locals[i].node];
+
+			result.Truncate(placeholders);
+			nodeMap.resize(placeholders);
+
+			for (size_t i = known; i < locals.size(); i++)
+			{
+				uint32_t value = locals[i].node;
+
+				result.Push(Expression::Kind::Number);
+				locals[i].node = result.Push(Expression::Kind::Let);
+				nodeMap.insert(nodeMap.end(), { value, value });
+			}
+
+			placeholders = result.Size();
+		}
+
+		SkipSpace();
+
+		if (*m_Input != ';')
+			break;
+
+		m_Input++;
+	}
+
+	// A read error cuts the input short, and that, not the syntax error it causes, is what failed.
+	if (m_ReadFailed)
+		m_State = State::ReadFailed;
+
+	if (!IsOk())
+	{
+		Metrics::AddError(m_State);
+		result.Clear();
+	}
+	else
+	{
+		for (auto& [name, definition] : definitions)
+		{
+			GetRegistry().definitions[name] = std::move(definition);
+			InsertToken(name);
+		}
+
+		if (graph && rooted)
+			graph->roots.push_back(root);
+	}
+
+	m_Input = nullptr;
+	m_Locals = nullptr;
+	m_Definitions = nullptr;
+
+	return result;
+}
+
+
+void Parser::SkipSpace()
+{
+	Fill();
+
+	while (std::isspace(*m_Input))
+	{
+		m_Input++;
+		Fill();
+	}
+}
+
+
+// Input before keep (or before the current position, if that comes first) is released.
+void Parser::Fill(size_t keep)
+{
+	if (!m_Reader || (size_t)(m_Buffer->data() + m_Buffer->size() - m_Input) >= STREAM_LOOKAHEAD)
+		return;
+
+	size_t position = Tell();
+	size_t consumed = std::min(keep, position) - m_Consumed;
+
+	m_Buffer->erase(0, consumed);
+	m_Consumed += consumed;
+
+	while (m_Buffer->size() - (position - m_Consumed) < STREAM_LOOKAHEAD)
+	{
+		size_t size = m_Buffer->size();
+		m_Buffer->resize(size + STREAM_CHUNK_SIZE);
+
+		size_t count = (*m_Reader)(std::span<char>(m_Buffer->data() + size, STREAM_CHUNK_SIZE));
+
+		if (count == READ_FAILED)
+		{
+			m_ReadFailed = true;
+			count = 0;
+		}
+
+		m_Buffer->resize(size + std::min(count, STREAM_CHUNK_SIZE));
+
+		for (size_t i = size; i < m_Buffer->size(); i++)
+		{
+			if (isalpha((*m_Buffer)[i]))
+				(*m_Buffer)[i] = tolower((*m_Buffer)[i]);
+		}
+
+		if (count == 0)
+		{
+			m_Reader = nullptr;
+			break;
+		}
+	}
+
+	m_Begin = m_Buffer->data();
+	m_Input = m_Begin + (position - m_Consumed);
+}
+
+
+size_t Parser::Tell() const
+{
+	return m_Consumed + (m_Input - m_Begin);
+}
+
+
+void Parser::Seek(size_t position)
+{
+	m_Input = m_Begin + (std::max(position, m_Consumed) - m_Consumed);
+}
+
+
+Document Parser::Open(std::string_view text)
+{
+	Document document(m_Resource);
+	document.text = text;
+
+	Reparse(document);
+	return document;
+}
+
+
+bool Parser::Edit(Document& document, size_t offset, size_t length, std::string_view replacement)
+{
+	offset = std::min(offset, document.text.size());
+	length = std::min(length, document.text.size() - offset);
+
+	document.text.replace(offset, length, replacement);
+
+	const Document::Group* best = nullptr;
+
+	for (const Document::Group& group : document.groups)
+	{
+		if (group.begin < offset && offset + length < group.end && (!best || group.end - group.begin < best->end - best->begin))
+			best = &group;
+	}
+
+	if (!best || document.expr.locals > 0 || !ReparseGroup(document, best - document.groups.data(), (int64_t)replacement.size() - (int64_t)length))
+		Reparse(document);
+
+	return IsOk();
+}
+
+
+long double Parser::Evaluate(Document& document, bool radians)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, 1);
+
+	m_State = State::Ok;
+	m_Radians = radians;
+
+	const Expression& expr = document.expr;
+
+	if (expr.Empty())
+	{
+		m_State = State::UnknownExpressionType;
+		return 0.0;
+	}
+
+	uint64_t generation = m_Registry ? m_Registry->generation : 0;
+
+	if (document.radians != radians || document.generation != generation)
+	{
+		document.radians = radians;
+		document.generation = generation;
+		document.Invalidate();
+	}
+
+	Bindings bindings = Bind(expr.symbols);
+
+	for (uint32_t node = 0; node < expr.Size() && IsOk(); node++)
+	{
+		Expression::Kind kind = expr.kinds[node];
+		uint32_t first = expr.firstChildren[node];
+
+		if (kind != Expression::Kind::Number && kind != Expression::Kind::Name)
+			document.dirty[node] |= document.dirty[first] | (kind != Expression::Kind::Local ? document.dirty[node - 1] : 0);
+
+		if (!document.dirty[node])
+			continue;
+
+		if (kind == Expression::Kind::Let || kind == Expression::Kind::Local)
+			document.values[node] = document.values[first];
+		else
+			document.values[node] = EvaluateNode(kind, bindings[expr.ops[node]], expr.values[node],
+				document.values[first], document.values[node > 0 ? node - 1 : 0], IsKnown(expr, bindings, first));
+	}
+
+	if (!IsOk())
+	{
+		document.Invalidate();
+		return 0.0;
+	}
+
+	std::fill(document.dirty.begin(), document.dirty.end(), 0);
+	return document.values[expr.Root()];
+}
+
+
+void Parser::Reparse(Document& document)
+{
+	document.groups.clear();
+
+	m_Groups = &document.groups;
+	Expression expr = Parse(document.text);
+	m_Groups = nullptr;
+
+	if (!IsOk())
+		document.groups.clear();
+
+	// Post-order puts the text before an edit first, so the nodes it produced keep their cached values.
+	const Expression& old = document.expr;
+	size_t same = 0;
+
+	for (size_t limit = std::min(old.Size(), expr.Size()); same < limit; same++)
+	{
+		Expression::Kind kind = expr.kinds[same];
+
+		if (old.kinds[same] != kind || old.firstChildren[same] != expr.firstChildren[same] || old.values[same] != expr.values[same] ||
+			(kind != Expression::Kind::Number && old.symbols[old.ops[same]] != expr.symbols[expr.ops[same]]))
+			break;
+	}
+
+	document.expr = std::move(expr);
+	document.values.resize(document.expr.Size(), 0.0L);
+	document.dirty.resize(document.expr.Size());
+
+	std::fill(document.dirty.begin() + same, document.dirty.end(), 1);
+}
+
+
+bool Parser::ReparseGroup(Document& document, size_t index, int64_t shift)
+{
+	Document::Group group = document.groups[index];
+	uint32_t end = (uint32_t)(group.end + shift);
+
+	std::pmr::string input(std::string_view(document.text).substr(group.begin + 1, end - group.begin - 2), m_Resource);
+
+	for (auto& c : input)
+	{
+		if (isalpha(c))
+			c = tolower(c);
+	}
+
+	Expression sub(m_Resource);
+	std::pmr::vector<Document::Group> groups(m_Resource);
+	std::pmr::vector<Local> locals(m_Resource);
+
+	m_Input = input.data();
+	m_Begin = input.data();
+	m_Groups = &groups;
+	m_Locals = &locals;
+	m_State = State::Ok;
+
+	ParseBinaryExpression(sub, 0);
+
+	while (std::isspace(*m_Input))
+		m_Input++;
+
+	bool complete = IsOk() && *m_Input == '\0';
+
+	m_Input = nullptr;
+	m_Groups = nullptr;
+	m_Locals = nullptr;
+
+	if (!complete)
+		return false;
+
+	Expression& expr = document.expr;
+
+	uint32_t first = group.first, last = group.node;
+	uint32_t size = (uint32_t)sub.Size();
+	int64_t delta = (int64_t)size - (int64_t)(last + 1 - first);
+
+	auto splice = [&](auto& target, auto begin, auto end)
+	{
+		target.erase(target.begin() + first, target.begin() + last + 1);
+		target.insert(target.begin() + first, begin, end);
+	};
+
+	std::pmr::vector<long double> zeros(size, 0.0L, m_Resource);
+	std::pmr::vector<uint8_t> ones(size, 1, m_Resource);
+
+	splice(expr.kinds, sub.kinds.begin(), sub.kinds.end());
+	splice(expr.ops, sub.ops.begin(), sub.ops.end());
+	splice(expr.firstChildren, sub.firstChildren.begin(), sub.firstChildren.end());
+	splice(expr.values, sub.values.begin(), sub.values.end());
+	splice(document.values, zeros.begin(), zeros.end());
+	splice(document.dirty, ones.begin(), ones.end());
+
+	for (uint32_t node = first; node < first + size; node++)
+	{
+		if (expr.kinds[node] != Expression::Kind::Number)
+			expr.ops[node] = expr.Intern(sub.symbols[expr.ops[node]]);
+
+		if (expr.kinds[node] == Expression::Kind::Let)
+			expr.values[node] += expr.locals;
+
+		expr.firstChildren[node] += first;
+	}
+
+	for (uint32_t node = first + size; node < expr.Size(); node++)
+	{
+		if (expr.firstChildren[node] >= last)
+			expr.firstChildren[node] = (uint32_t)(expr.firstChildren[node] + delta);
+	}
+
+	expr.locals += sub.locals;
+
+	std::erase_if(document.groups, [&](const Document::Group& other)
+	{
+		return other.begin >= group.begin && other.end <= group.end;
+	});
+
+	for (Document::Group& other : document.groups)
+	{
+		if (other.first > last) other.first = (uint32_t)(other.first + delta);
+		if (other.node > last) other.node = (uint32_t)(other.node + delta);
+		if (other.begin >= group.end) other.begin = (uint32_t)(other.begin + shift);
+		if (other.end >= group.end) other.end = (uint32_t)(other.end + shift);
+	}
+
+	for (const Document::Group& inner : groups)
+		document.groups.push_back({ inner.first + first, inner.node + first, inner.begin + group.begin + 1, inner.end + group.begin + 1 });
+
+	document.groups.push_back({ first, first + size - 1, group.begin, end });
+	return true;
+}
+
+
+Graph Parser::Parse(std::span<const std::string_view> inputs)
+{
+	Graph graph(m_Resource);
+
+	for (std::string_view input : inputs)
+	{
+		Expression expr = Parse(input);
+
+		if (!IsOk())
+			break;
+
+		// A formula of definitions alone has no value to output.
+		if (expr.Empty())
+		{
+			m_State = State::UnknownExpressionType;
+			Metrics::AddError(m_State);
+			break;
+		}
+
+		graph.Add(expr);
+	}
+
+	return graph;
+}
+
+
+long double Parser::Evaluate(const Expression& expr, bool radians)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, 1);
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	return Evaluate(expr);
+}
+
+
+bool Parser::Evaluate(const Expression& expr, bool radians, const Columns& inputs, std::span<double> output)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, output.size());
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	for (const auto& [name, column] : inputs)
+	{
+		if (column.size() < output.size())
+		{
+			m_State = State::InvalidInput;
+			return false;
+		}
+	}
+
+	if (expr.Empty())
+	{
+		m_State = State::UnknownExpressionType;
+		return false;
+	}
+
+	Bindings bindings = Bind(expr.symbols);
+
+	for (size_t i = 0; i < expr.symbols.size(); i++)
+	{
+		auto column = inputs.find(std::string_view(expr.symbols[i]));
+
+		if (column != inputs.end())
+			bindings[i].column = &column->second;
+	}
+
+	AlignedResource aligned(m_Resource, false);
+
+	Scratch scratch(&aligned);
+	Scratch locals(&aligned);
+
+	std::pmr::vector<uint8_t> statements = expr.Statements();
+
+	for (size_t offset = 0; offset < output.size() && IsOk(); offset += BLOCK_SIZE)
+	{
+		size_t count = std::min(BLOCK_SIZE, output.size() - offset);
+		EvaluateBlock(expr, statements, bindings, offset, output.subspan(offset, count), scratch, locals);
+	}
+
+	return IsOk();
+}
+
+
+bool Parser::Evaluate(const Graph& graph, bool radians, std::span<long double> outputs)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, 1);
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	if (outputs.size() < graph.roots.size())
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	Bindings bindings = Bind(graph.symbols);
+	std::pmr::vector<long double> results(graph.Size(), m_Resource);
+
+	for (uint32_t node = 0; node < graph.Size() && IsOk(); node++)
+	{
+		uint32_t lhs = graph.lhs[node];
+
+		results[node] = EvaluateNode(graph.kinds[node], bindings[graph.ops[node]], graph.values[node],
+			results[lhs], results[graph.rhs[node]], IsKnown(graph.kinds[lhs], bindings[graph.ops[lhs]]));
+	}
+
+	for (size_t i = 0; i < graph.roots.size(); i++)
+		outputs[i] = results[graph.roots[i]];
+
+	return IsOk();
+}
+
+
+Program Parser::Compile(const Graph& graph)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::CompileNanoseconds, Metrics::Counter::FormulasCompiled, graph.roots.size());
+
+	Program program(m_Resource);
+	program.symbols.assign(graph.symbols.begin(), graph.symbols.end());
+
+	Bindings bindings = Bind(graph.symbols);
+
+	constexpr uint32_t LIVE = UINT32_MAX;
+	std::pmr::vector<uint32_t> lastUse(graph.Size(), 0, m_Resource);
+
+	for (uint32_t node = 0; node < graph.Size(); node++)
+	{
+		if (graph.kinds[node] == Expression::Kind::Unary || graph.kinds[node] == Expression::Kind::Binary)
+			lastUse[graph.lhs[node]] = node;
+
+		if (graph.kinds[node] == Expression::Kind::Binary)
+			lastUse[graph.rhs[node]] = node;
+	}
+
+	for (uint32_t root : graph.roots)
+		lastUse[root] = LIVE;
+
+	std::pmr::vector<uint32_t> registerOf(graph.Size(), 0, m_Resource);
+	std::pmr::vector<uint32_t> free(m_Resource);
+
+	auto allocate = [&]()
+	{
+		if (free.empty())
+			return program.registers++;
+
+		uint32_t r = free.back();
+		free.pop_back();
+
+		return r;
+	};
+
+	for (uint32_t node = 0; node < graph.Size(); node++)
+	{
+		Expression::Kind kind = graph.kinds[node];
+		Program::Instruction instruction = { kind, graph.ops[node], 0, 0, 0, graph.values[node], false, false, 0 };
+
+		if (kind == Expression::Kind::Unary || kind == Expression::Kind::Binary)
+		{
+			uint32_t lhs = graph.lhs[node];
+			instruction.lhs = registerOf[lhs];
+			instruction.knownBase = IsKnown(graph.kinds[lhs], bindings[graph.ops[lhs]]);
+
+			if (lastUse[lhs] == node)
+				instruction.target = instruction.lhs;
+			else
+				instruction.target = allocate();
+		}
+		else
+			instruction.target = allocate();
+
+		if (kind == Expression::Kind::Binary)
+		{
+			uint32_t rhs = graph.rhs[node];
+			instruction.rhs = registerOf[rhs];
+			instruction.knownExponent = IsKnown(graph.kinds[rhs], bindings[graph.ops[rhs]]);
+
+			if (lastUse[rhs] == node && instruction.rhs != instruction.target)
+				free.push_back(instruction.rhs);
+		}
+
+		registerOf[node] = instruction.target;
+		program.code.push_back(instruction);
+	}
+
+	for (uint32_t root : graph.roots)
+		program.outputs.push_back(registerOf[root]);
+
+	return program;
+}
+
+
+Program Parser::Compile(std::span<const std::string_view> inputs)
+{
+	Graph graph = Parse(inputs);
+
+	if (!IsOk())
+		return Program(m_Resource);
+
+	return Compile(graph);
+}
+
+
+bool Parser::Evaluate(const Program& program, bool radians, std::span<long double> outputs)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, 1);
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	if (outputs.size() < program.outputs.size())
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	Bindings bindings = Bind(program.symbols);
+	std::pmr::vector<long double> registers(program.registers, m_Resource);
+
+	for (const Program::Instruction& instruction : program.code)
+	{
+		if (instruction.table && program.tables[instruction.table - 1].radians == m_Radians)
+		{
+			double x = (double)registers[instruction.lhs];
+			ApplyTable(program.tables[instruction.table - 1], bindings[instruction.op], { &x, 1 });
+
+			registers[instruction.target] = x;
+		}
+		else
+			registers[instruction.target] = EvaluateNode(instruction.kind, bindings[instruction.op], instruction.value,
+				registers[instruction.lhs], registers[instruction.rhs], instruction.knownBase);
+
+		if (!IsOk())
+			return false;
+	}
+
+	for (size_t i = 0; i < program.outputs.size(); i++)
+		outputs[i] = registers[program.outputs[i]];
+
+	return true;
+}
+
+
+bool Parser::Evaluate(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, outputs.empty() ? 0 : outputs[0].size());
+	return EvaluateProgram(program, radians, inputs, outputs, stop);
+}
+
+
+// Evaluate without a Metrics scope, for callers that record the whole evaluation themselves.
+bool Parser::EvaluateProgram(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop)
+{
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	if (outputs.size() < program.outputs.size())
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	size_t rows = outputs.empty() ? 0 : outputs[0].size();
+
+	for (std::span<double> output : outputs)
+		if (output.size() != rows)
+			m_State = State::InvalidInput;
+
+	for (const auto& [name, column] : inputs)
+		if (column.size() < rows)
+			m_State = State::InvalidInput;
+
+	if (!IsOk())
+		return false;
+
+	Bindings bindings = Bind(program.symbols);
+
+	for (size_t i = 0; i < program.symbols.size(); i++)
+	{
+		auto column = inputs.find(std::string_view(program.symbols[i]));
+
+		if (column != inputs.end())
+			bindings[i].column = &column->second;
+	}
+
+	AlignedResource aligned(m_Resource, false);
+	Scratch registers(&aligned);
+
+	for (size_t offset = 0; offset < rows && IsOk(); offset += BLOCK_SIZE)
+	{
+		if (stop.stop_requested())
+		{
+			m_State = State::Cancelled;
+			break;
+		}
+
+		size_t count = std::min(BLOCK_SIZE, rows - offset);
+		EvaluateBlock(program, bindings, offset, count, registers);
+
+		for (size_t i = 0; i < program.outputs.size() && IsOk(); i++)
+		{
+			std::span<double> result = GetScratch(registers, program.outputs[i], count);
+			std::copy(result.begin(), result.end(), outputs[i].begin() + offset);
+		}
+	}
+
+	return IsOk();
+}
+
+
+AsyncEvaluation Parser::EvaluateAsync(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs, std::stop_token stop,
+	Resume resume)
+{
+	return AsyncEvaluation(*this, program, radians, inputs, outputs, stop, std::move(resume));
+}
+
+Parser::Approximation Parser::Approximate(Program& program, bool radians, double tolerance)
+{
+	static constexpr long double INF = std::numeric_limits<long double>::infinity();
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	Approximation approximation;
+	Bindings bindings = Bind(program.symbols);
+
+	// Interval analysis in program order: each register holds the range of values it can take.
+	std::pmr::vector<Range> intervals(program.registers + 1, Range{ -INF, INF }, m_Resource);
+
+	program.tables.clear();
+
+	for (Program::Instruction& instruction : program.code)
+	{
+		const Binding& binding = bindings[instruction.op];
+
+		Range a = intervals[instruction.lhs];
+		Range b = intervals[instruction.rhs];
+		Range result = { -INF, INF };
+
+		instruction.table = 0;
+
+		switch (instruction.kind)
+		{
+		case Expression::Kind::Number:
+			result = { instruction.value, instruction.value };
+			break;
+
+		case Expression::Kind::Name:
+			if (m_Registry && m_Registry->ranges.contains(std::string_view(program.symbols[instruction.op])))
+				result = m_Registry->ranges.find(std::string_view(program.symbols[instruction.op]))->second;
+			else if (binding.constant)
+				result = { *binding.value, *binding.value };
+			break;
+
+		case Expression::Kind::Unary:
+		{
+			std::string_view name = !binding.function && binding.builtinFunction ? binding.builtinFunction->name : std::string_view();
+
+			if (name == "+")
+				result = a;
+			else if (name == "-")
+				result = { -a.high, -a.low };
+			else if (name == "abs")
+				result = a.low >= 0.0L ? a : a.high <= 0.0L ? Range{ -a.high, -a.low } : Range{ 0.0L, std::max(-a.low, a.high) };
+			else if ((binding.function || binding.builtinFunction) && std::isfinite(a.low) && std::isfinite(a.high) && a.low < a.high)
+			{
+				Program::LookupTable table;
+				table.radians = radians;
+
+				if (!BuildTable(binding, a, tolerance, table))
+				{
+					approximation.rejected++;
+					m_State = State::Ok;
+					break;
+				}
+
+				auto [low, high] = std::minmax_element(table.values.begin(), table.values.end());
+				result = { *low - table.error, *high + table.error };
+
+				approximation.tables++;
+				approximation.entries += table.values.size();
+				approximation.bytes += sizeof(table) + table.values.size() * sizeof(double);
+				approximation.maxError = std::max(approximation.maxError, table.error);
+
+				program.tables.push_back(std::move(table));
+				instruction.table = (uint32_t)program.tables.size();
+			}
+		}
+		break;
+
+		case Expression::Kind::Binary:
+			result = Combine(binding.arithmetic, a, b);
+			break;
+
+		default:
+			break;
+		}
+
+		intervals[instruction.target] = result;
+	}
+
+	Metrics::Add(Metrics::Counter::TablesBuilt, approximation.tables);
+	Metrics::Add(Metrics::Counter::TableBytes, approximation.bytes);
+
+	return approximation;
+}
+
+
+bool Parser::EvaluateFixed(const Program& program, FixedPoint& fixed, bool radians, const FixedColumns& inputs, std::span<const std::span<int64_t>> outputs)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, outputs.empty() ? 0 : outputs[0].size());
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	if (outputs.size() < program.outputs.size())
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	size_t rows = outputs.empty() ? 0 : outputs[0].size();
+
+	for (std::span<int64_t> output : outputs)
+		if (output.size() != rows)
+			m_State = State::InvalidInput;
+
+	for (const auto& [name, column] : inputs)
+		if (column.size() < rows)
+			m_State = State::InvalidInput;
+
+	if (!IsOk())
+		return false;
+
+	Bindings bindings = Bind(program.symbols);
+
+	std::pmr::vector<const std::span<const int64_t>*> columns(bindings.size(), nullptr, m_Resource);
+	std::pmr::vector<int64_t> constants(program.code.size(), m_Resource);
+
+	for (size_t i = 0; i < program.symbols.size(); i++)
+	{
+		auto column = inputs.find(std::string_view(program.symbols[i]));
+
+		if (column != inputs.end())
+			columns[i] = &column->second;
+	}
+
+	// Literals and scalar variables are converted once, so every row sees the same bits.
+	for (size_t i = 0; i < program.code.size(); i++)
+	{
+		const Program::Instruction& instruction = program.code[i];
+
+		if (instruction.kind == Expression::Kind::Number)
+			constants[i] = fixed.FromDouble((double)instruction.value);
+		else if (instruction.kind == Expression::Kind::Name && !columns[instruction.op])
+		{
+			if (!bindings[instruction.op].value)
+			{
+				m_State = State::UnknownExpressionType;
+				return false;
+			}
+
+			constants[i] = fixed.FromDouble((double)*bindings[instruction.op].value);
+		}
+	}
+
+	std::pmr::vector<int64_t> registers(program.registers + 1, m_Resource);
+
+	for (size_t row = 0; row < rows && IsOk(); row++)
+	{
+		for (size_t i = 0; i < program.code.size() && IsOk(); i++)
+		{
+			const Program::Instruction& instruction = program.code[i];
+
+			if (instruction.kind == Expression::Kind::Name && columns[instruction.op])
+				registers[instruction.target] = (*columns[instruction.op])[row];
+			else if (instruction.kind == Expression::Kind::Number || instruction.kind == Expression::Kind::Name)
+				registers[instruction.target] = constants[i];
+			else
+				registers[instruction.target] = EvaluateFixedNode(instruction, bindings[instruction.op], fixed,
+					registers[instruction.lhs], registers[instruction.rhs]);
+		}
+
+		for (size_t i = 0; i < program.outputs.size(); i++)
+			outputs[i][row] = registers[program.outputs[i]];
+	}
+
+	return IsOk();
+}
+
+FixedPoint::Report Parser::CompareFixed(const Program& program, FixedPoint fixed, bool radians, const Columns& inputs)
+{
+	FixedPoint::Report report;
+
+	size_t rows = inputs.empty() ? 1 : std::numeric_limits<size_t>::max();
+
+	for (const auto& [name, column] : inputs)
+		rows = std::min(rows, column.size());
+
+	std::pmr::vector<std::pmr::vector<int64_t>> converted(m_Resource);
+	FixedColumns fixedInputs(m_Resource);
+
+	for (const auto& [name, column] : inputs)
+	{
+		std::pmr::vector<int64_t>& values = converted.emplace_back(rows);
+
+		for (size_t i = 0; i < rows; i++)
+			values[i] = fixed.FromDouble(column[i]);
+
+		fixedInputs.emplace(name, values);
+	}
+
+	std::pmr::vector<std::pmr::vector<double>> reference(program.outputs.size(), std::pmr::vector<double>(rows), m_Resource);
+	std::pmr::vector<std::pmr::vector<int64_t>> results(program.outputs.size(), std::pmr::vector<int64_t>(rows), m_Resource);
+
+	std::pmr::vector<std::span<double>> referenceOutputs(reference.begin(), reference.end(), m_Resource);
+	std::pmr::vector<std::span<int64_t>> fixedOutputs(results.begin(), results.end(), m_Resource);
+
+	if (!Evaluate(program, radians, inputs, referenceOutputs) || !EvaluateFixed(program, fixed, radians, fixedInputs, fixedOutputs))
+		return report;
+
+	size_t counted = 0;
+
+	for (size_t output = 0; output < program.outputs.size(); output++)
+	{
+		for (size_t row = 0; row < rows; row++)
+		{
+			if (!std::isfinite(reference[output][row]))
+			{
+				report.undefined++;
+				continue;
+			}
+
+			double error = std::fabs(fixed.ToDouble(results[output][row]) - reference[output][row]);
+
+			if (error > report.maxError)
+			{
+				report.maxError = error;
+				report.worstRow = row;
+				report.worstOutput = output;
+			}
+
+			report.meanError += error;
+			counted++;
+		}
+	}
+
+	report.rows = rows;
+	report.saturations = fixed.GetSaturations();
+	report.meanError = counted == 0 ? 0.0 : report.meanError / counted;
+
+	return report;
+}
+
+
+bool Parser::EvaluateSum(const Program& program, bool radians, const Columns& inputs, size_t rows, std::span<double> sums,
+	WorkerPool& pool, std::stop_token stop)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, rows);
+
+	m_State = State::Ok;
+
+	if (sums.size() < program.outputs.size())
+		m_State = State::InvalidInput;
+
+	for (const auto& [name, column] : inputs)
+		if (column.size() < rows)
+			m_State = State::InvalidInput;
+
+	if (!IsOk())
+		return false;
+
+	// Each fixed chunk of rows is summed on its own and the chunk sums are combined by a fixed tree, so the result
+	// is the same for any thread count, including a single thread.
+	size_t chunks = (rows + WorkerPool::CHUNK_SIZE - 1) / WorkerPool::CHUNK_SIZE;
+	size_t outputs = program.outputs.size();
+
+	std::pmr::vector<double> partials(chunks * outputs, m_Resource);
+
+	std::mutex mutex;
+	std::atomic<bool> failed = false;
+
+	auto reduce = [&](size_t offset, size_t count)
+	{
+		if (failed.load(std::memory_order_relaxed))
+			return;
+
+		Parser worker(std::pmr::new_delete_resource());
+
+		{
+			std::lock_guard lock(mutex);
+			worker = *this;
+		}
+
+		worker.SetResource(std::pmr::new_delete_resource());
+
+		Columns slices(std::pmr::new_delete_resource());
+
+		for (const auto& [name, column] : inputs)
+			slices.emplace(name, column.subspan(offset, count));
+
+		std::vector<std::vector<double>> values(outputs, std::vector<double>(count));
+		std::vector<std::span<double>> targets(values.begin(), values.end());
+
+		if (!worker.EvaluateProgram(program, radians, slices, targets, stop))
+		{
+			if (!failed.exchange(true))
+				m_State = worker.GetState();
+
+			return;
+		}
+
+		for (size_t i = 0; i < outputs; i++)
+			partials[i * chunks + offset / WorkerPool::CHUNK_SIZE] = Sum(values[i]);
+	};
+
+	if (chunks > 1 && pool.GetThreadCount() > 1)
+		pool.ForEach(rows, reduce);
+	else
+	{
+		for (size_t offset = 0; offset < rows; offset += WorkerPool::CHUNK_SIZE)
+			reduce(offset, std::min(WorkerPool::CHUNK_SIZE, rows - offset));
+	}
+
+	if (!IsOk())
+		return false;
+
+	for (size_t i = 0; i < outputs; i++)
+		sums[i] = Sum(std::span<const double>(partials).subspan(i * chunks, chunks));
+
+	return true;
+}
+
+
+bool Parser::EvaluateMixed(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs,
+	double tolerance, size_t* refined)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, outputs.empty() ? 0 : outputs[0].size());
+
+	m_Radians = radians;
+	m_State = State::Ok;
+
+	if (refined)
+		*refined = 0;
+
+	if (outputs.size() < program.outputs.size())
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	size_t rows = outputs.empty() ? 0 : outputs[0].size();
+
+	for (std::span<double> output : outputs)
+		if (output.size() != rows)
+			m_State = State::InvalidInput;
+
+	for (const auto& [name, column] : inputs)
+		if (column.size() < rows)
+			m_State = State::InvalidInput;
+
+	if (!IsOk())
+		return false;
+
+	Bindings bindings = Bind(program.symbols);
+
+	for (size_t i = 0; i < program.symbols.size(); i++)
+	{
+		auto column = inputs.find(std::string_view(program.symbols[i]));
+
+		if (column != inputs.end())
+			bindings[i].column = &column->second;
+	}
+
+	AlignedResource aligned(m_Resource, false);
+
+	Scratch registers(&aligned);
+	Scratch errors(&aligned);
+
+	std::pmr::vector<long double> precise(program.registers + 1, m_Resource);
+
+	for (size_t offset = 0; offset < rows && IsOk(); offset += BLOCK_SIZE)
+	{
+		size_t count = std::min(BLOCK_SIZE, rows - offset);
+		EvaluateBlock(program, bindings, offset, count, registers, &errors);
+
+		for (size_t i = 0; i < program.outputs.size() && IsOk(); i++)
+		{
+			std::span<double> result = GetScratch(registers, program.outputs[i], count);
+			std::copy(result.begin(), result.end(), outputs[i].begin() + offset);
+		}
+
+		// Rows whose estimated error exceeds the tolerance in any output are evaluated again in long double.
+		for (size_t row = 0; row < count && IsOk(); row++)
+		{
+			bool flagged = false;
+
+			for (uint32_t output : program.outputs)
+				flagged = flagged || !(GetScratch(errors, output, count)[row] <= tolerance);
+
+			if (!flagged)
+				continue;
+
+			EvaluateRow(program, bindings, offset + row, precise);
+
+			for (size_t i = 0; i < program.outputs.size(); i++)
+				outputs[i][offset + row] = (double)precise[program.outputs[i]];
+
+			if (refined)
+				(*refined)++;
+		}
+	}
+
+	return IsOk();
+}
+
+
+bool Parser::EvaluateParallel(const Program& program, bool radians, const Columns& inputs, std::span<const std::span<double>> outputs,
+	WorkerPool& pool, std::stop_token stop)
+{
+	size_t rows = outputs.empty() ? 0 : outputs[0].size();
+
+	if (rows <= WorkerPool::CHUNK_SIZE || pool.GetThreadCount() < 2)
+		return Evaluate(program, radians, inputs, outputs, stop);
+
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, rows);
+
+	m_State = State::Ok;
+
+	if (outputs.size() < program.outputs.size())
+		m_State = State::InvalidInput;
+
+	for (std::span<double> output : outputs)
+		if (output.size() != rows)
+			m_State = State::InvalidInput;
+
+	for (const auto& [name, column] : inputs)
+		if (column.size() < rows)
+			m_State = State::InvalidInput;
+
+	if (!IsOk())
+		return false;
+
+	std::mutex mutex;
+	std::atomic<bool> failed = false;
+
+	pool.ForEach(rows, [&](size_t offset, size_t count)
+	{
+		if (failed.load(std::memory_order_relaxed))
+			return;
+
+		Parser worker(std::pmr::new_delete_resource());
+
+		{
+			std::lock_guard lock(mutex);
+			worker = *this;
+		}
+
+		worker.SetResource(std::pmr::new_delete_resource());
+
+		Columns slices(std::pmr::new_delete_resource());
+
+		for (const auto& [name, column] : inputs)
+			slices.emplace(name, column.subspan(offset, count));
+
+		std::vector<std::span<double>> targets;
+
+		for (std::span<double> output : outputs)
+			targets.push_back(output.subspan(offset, count));
+
+		if (!worker.EvaluateProgram(program, radians, slices, targets, stop) && !failed.exchange(true))
+			m_State = worker.GetState();
+	});
+
+	return IsOk();
+}
+
+
+std::string Parser::Translate(std::span<const std::string_view> names, std::span<const Program> programs, bool radians)
+{
+	m_State = State::Ok;
+
+	std::string source =
+		"#include <cmath>\n"
+		"#include <cstddef>\n"
+		"#include <limits>\n"
+		"\n"
+		"struct CompiledFormula\n"
+		"{\n"
+		"\tconst char* name;\n"
+		"\tunsigned variableCount;\n"
+		"\tconst char* const* variables;\n"
+		"\tlong double (*scalar)(const long double*);\n"
+		"\tvoid (*batch)(const double* const*, double*, size_t);\n"
+		"};\n"
+		"\n"
+		"template <typename T>\n"
+		"static inline T Power(T base, int exponent)\n"
+		"{\n"
+		"\tunsigned n = exponent < 0 ? -exponent : exponent;\n"
+		"\tT result = 1;\n"
+		"\n"
+		"\tfor (; n > 0; n >>= 1, base *= base)\n"
+		"\t\tif (n & 1)\n"
+		"\t\t\tresult *= base;\n"
+		"\n"
+		"\treturn exponent < 0 ? 1 / result : result;\n"
+		"}\n"
+		"\n"
+		"template <typename T>\n"
+		"static inline T Sqrt(T base)\n"
+		"{\n"
+		"\treturn base == 0 || std::isinf(base) ? std::fabs(base) : std::sqrt(base);\n"
+		"}\n";
+
+	std::string table;
+
+	for (size_t i = 0; i < programs.size() && IsOk(); i++)
+	{
+		const Program& program = programs[i];
+		std::string id = "formula" + std::to_string(i);
+
+		// The CompiledFormula table has one result per entry, so a program must have exactly one output.
+		if (program.outputs.size() != 1)
+		{
+			m_State = program.outputs.empty() ? State::UnknownExpressionType : State::InvalidInput;
+			break;
+		}
+
+		size_t first = std::find(programs.begin(), programs.end(), program) - programs.begin();
+
+		Bindings bindings = Bind(program.symbols);
+		std::vector<int> variables(program.symbols.size(), -1);
+		std::string list;
+
+		int count = 0;
+
+		for (size_t k = 0; k < program.symbols.size(); k++)
+		{
+			if (bindings[k].value && !bindings[k].constant)
+			{
+				variables[k] = count++;
+				list += TranslateString(program.symbols[k]) + ", ";
+			}
+		}
+
+		if (first < i)
+		{
+			id = "formula" + std::to_string(first);
+			table += "\t{ " + TranslateString(names[i]) + ", " + std::to_string(count) + ", " + id + "_variables, " + id + ", " + id + "_batch },\n";
+			continue;
+		}
+
+		source += "\nstatic const char* const " + id + "_variables[] = { " + list + "nullptr };\n";
+
+		// Registers that never reach the output would be unused variables in the generated code.
+		std::vector<bool> live(program.code.size());
+		std::vector<bool> needed(program.registers);
+		needed[program.outputs[0]] = true;
+
+		for (size_t n = program.code.size(); n-- > 0;)
+		{
+			const Program::Instruction& instruction = program.code[n];
+
+			if (!needed[instruction.target])
+				continue;
+
+			live[n] = true;
+			needed[instruction.target] = false;
+
+			if (instruction.kind == Expression::Kind::Unary || instruction.kind == Expression::Kind::Binary)
+				needed[instruction.lhs] = true;
+
+			if (instruction.kind == Expression::Kind::Binary)
+				needed[instruction.rhs] = true;
+		}
+
+		for (bool batch : { false, true })
+		{
+			std::string type = batch ? "double" : "long double";
+			std::string indent = batch ? "\t\t" : "\t";
+
+			if (batch)
+				source += "\nstatic void " + id + "_batch(const double* const* in, double* out, size_t rows)\n{\n\tfor (size_t i = 0; i < rows; i++)\n\t{\n";
+			else
+				source += "\nstatic long double " + id + "(const long double* in)\n{\n";
+
+			std::vector<std::string> operands(program.registers);
+			std::vector<const Program::Instruction*> sources(program.registers);
+
+			for (size_t n = 0; n < program.code.size() && IsOk(); n++)
+			{
+				if (!live[n])
+					continue;
+
+				const Program::Instruction& instruction = program.code[n];
+				std::string value = TranslateInstruction(instruction, bindings, variables, operands, sources, batch, radians);
+
+				operands[instruction.target] = "v" + std::to_string(n);
+				sources[instruction.target] = &instruction;
+
+				source += indent + "const " + type + " v" + std::to_string(n) + " = " + value + ";\n";
+			}
+
+			if (!IsOk())
+				break;
+
+			if (batch)
+				source += "\t\tout[i] = " + operands[program.outputs[0]] + ";\n\t}\n}\n";
+			else
+				source += "\treturn " + operands[program.outputs[0]] + ";\n}\n";
+		}
+
+		table += "\t{ " + TranslateString(names[i]) + ", " + std::to_string(count) + ", " + id + "_variables, " + id + ", " + id + "_batch },\n";
+	}
+
+	if (!IsOk())
+		return {};
+
+	source += "\nextern \"C\" const CompiledFormula mathparser_formulas[] =\n{\n" + table + "\t{ nullptr, 0, nullptr, nullptr, nullptr }\n};\n";
+	source += "\nextern \"C\" const unsigned mathparser_formula_count = " + std::to_string(programs.size()) + ";\n";
+
+	return source;
+}
+
+
+std::string Parser::TranslateInstruction(const Program::Instruction& instruction, const Bindings& bindings,
+	std::span<const int> variables, std::span<const std::string> operands, std::span<const Program::Instruction* const> sources, bool batch, bool radians)
+{
+	const Binding& binding = bindings[instruction.op];
+
+	const std::string& a = operands[instruction.lhs];
+	const std::string& b = operands[instruction.rhs];
+
+	switch (instruction.kind)
+	{
+	case Expression::Kind::Number:
+		return TranslateLiteral(instruction.value, batch);
+
+	case Expression::Kind::Name:
+		if (variables[instruction.op] >= 0)
+			return "in[" + std::to_string(variables[instruction.op]) + "]" + (batch ? "[i]" : "");
+
+		if (binding.value)
+			return TranslateLiteral(*binding.value, batch);
+
+		m_State = State::UnknownExpressionType;
+		return {};
+
+	case Expression::Kind::Unary:
+	{
+		static constexpr std::pair<std::string_view, std::string_view> FUNCTIONS[] =
+		{
+			{ "abs", "std::abs" }, { "log2", "std::log2" }, { "lg", "std::log10" }, { "ln", "std::log" },
+			{ "sin", "std::sin" }, { "cos", "std::cos" }, { "tan", "std::tan" }, { "asin", "std::asin" },
+			{ "acos", "std::acos" }, { "atan", "std::atan" }, { "sqrt", "std::sqrt" }
+		};
+
+		const BuiltinFunction* builtin = binding.function ? nullptr : binding.builtinFunction;
+
+		if (!builtin)
+			break;
+
+		if (builtin->name == "+") return a;
+		if (builtin->name == "-") return "-" + a;
+		if (builtin->name == "!") return "std::tgamma(" + a + " + 1)";
+
+		std::string degrees = TranslateLiteral(180.0L / std::numbers::pi_v<long double>, batch);
+
+		for (auto [name, call] : FUNCTIONS)
+		{
+			if (name != builtin->name)
+				continue;
+
+			if (radians || builtin->angle == Angle::None)
+				return std::string(call) + "(" + a + ")";
+
+			if (builtin->angle == Angle::Argument)
+				return std::string(call) + "(" + a + " / " + degrees + ")";
+
+			return std::string(call) + "(" + a + ") * " + degrees;
+		}
+	}
+	break;
+
+	case Expression::Kind::Binary:
+		switch (binding.arithmetic)
+		{
+		case '+': return a + " + " + b;
+		case '-': return a + " - " + b;
+		case '*': return a + " * " + b;
+		case '/': return a + " / " + b;
+
+		case '^':
+		{
+			const Program::Instruction* base = sources[instruction.lhs];
+			const Program::Instruction* exponent = sources[instruction.rhs];
+
+			if (instruction.knownBase && base->kind == Expression::Kind::Number && base->value == 2.0L)
+				return "std::exp2(" + b + ")";
+
+			if (instruction.knownBase && base->kind == Expression::Kind::Name && bindings[base->op].constant && *bindings[base->op].value == std::numbers::e_v<long double>)
+				return "std::exp(" + b + ")";
+
+			if (instruction.knownExponent && exponent->kind == Expression::Kind::Number)
+			{
+				switch (ClassifyPower(NAN, exponent->value))
+				{
+				case PowerKind::Integer: return "Power(" + a + ", " + std::to_string((int)exponent->value) + ")";
+				case PowerKind::Identity: return a;
+				case PowerKind::Sqrt: return "Sqrt(" + a + ")";
+				case PowerKind::InverseSqrt: return "1 / Sqrt(" + a + ")";
+				default: break;
+				}
+			}
+
+			return "std::pow(" + a + ", " + b + ")";
+		}
+		}
+
+		if (!binding.op && binding.builtinOperator && binding.builtinOperator->name == "%")
+			return "(" + std::string(batch ? "double" : "long double") + ")((long int)" + a + " % (long int)" + b + ")";
+
+		m_State = State::UnknownBinaryOperator;
+		return {};
+
+	default:
+		break;
+	}
+
+	m_State = State::UnknownUnaryOperator;
+	return {};
+}
+
+
+std::string Parser::TranslateLiteral(long double value, bool batch)
+{
+	std::string limits = batch ? "std::numeric_limits<double>::" : "std::numeric_limits<long double>::";
+
+	if (std::isnan(value))
+		return "(" + limits + "quiet_NaN())";
+
+	if (std::isinf(value))
+		return "(" + std::string(value < 0.0L ? "-" : "") + limits + "infinity())";
+
+	char buffer[64];
+
+	if (batch)
+		std::snprintf(buffer, sizeof(buffer), "%.17g", (double)value);
+	else
+		std::snprintf(buffer, sizeof(buffer), "%.21LgL", value);
+
+	std::string literal = buffer;
+
+	if (literal.find_first_of(".en") == std::string::npos)
+		literal.insert(batch ? literal.size() : literal.size() - 1, ".0");
+
+	return "(" + literal + ")";
+}
+
+
+std::string Parser::TranslateString(std::string_view text)
+{
+	std::string literal = "\"";
+
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			literal += {'\\', c};
+		else if (std::isprint((unsigned char)c))
+			literal += c;
+		else
+		{
+			// Three octal digits always end the escape, unlike \x which would swallow following hex digits.
+			char buffer[8];
+			std::snprintf(buffer, sizeof(buffer), "\\%03o", (unsigned char)c);
+			literal += buffer;
+		}
+	}
+
+	return literal + "\"";
+}
+
+
+bool Parser::Load(std::string_view path)
+{
+	std::string file(path);
+
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(file.c_str());
+
+	auto formulas = library ? (const CompiledFormula*)GetProcAddress(library, "mathparser_formulas") : nullptr;
+	auto count = library ? (const unsigned*)GetProcAddress(library, "mathparser_formula_count") : nullptr;
+#else
+	void* library = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+	auto formulas = library ? (const CompiledFormula*)dlsym(library, "mathparser_formulas") : nullptr;
+	auto count = library ? (const unsigned*)dlsym(library, "mathparser_formula_count") : nullptr;
+#endif
+
+	if (!formulas || !count)
+	{
+		m_State = State::InvalidInput;
+		return false;
+	}
+
+	Registry& registry = GetRegistry();
+
+	for (unsigned i = 0; i < *count; i++)
+	{
+		const CompiledFormula& formula = formulas[i];
+		Compiled& compiled = registry.compiled[formula.name];
+
+		compiled.variables.assign(formula.variables, formula.variables + formula.variableCount);
+		compiled.scalar = formula.scalar;
+		compiled.batch = formula.batch;
+	}
+
+	m_State = State::Ok;
+	return true;
+}
+
+
+uint64_t Parser::Hash(std::string_view text)
+{
+	Expression expr = Parse(text);
+	return IsOk() ? expr.Hash() : 0;
+}
+
+
+const Parser::Compiled* Parser::GetCompiled(std::string_view name) const
+{
+	if (!m_Registry)
+		return nullptr;
+
+	auto it = m_Registry->compiled.find(name);
+	return it != m_Registry->compiled.end() ? &it->second : nullptr;
+}
+
+
+long double Parser::Evaluate(const Compiled& compiled)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, 1);
+
+	m_State = State::Ok;
+	std::pmr::vector<long double> inputs(m_Resource);
+
+	for (const std::string& variable : compiled.variables)
+	{
+		const long double* value = FindVariable(variable);
+
+		if (!value)
+		{
+			m_State = State::UnknownExpressionType;
+			return 0.0;
+		}
+
+		inputs.push_back(*value);
+	}
+
+	return compiled.scalar(inputs.data());
+}
+
+
+bool Parser::Evaluate(const Compiled& compiled, const Columns& inputs, std::span<double> output)
+{
+	Metrics::Scope scope(m_State, Metrics::Counter::EvaluateNanoseconds, Metrics::Counter::Evaluations, 1, output.size());
+
+	m_State = State::Ok;
+
+	std::pmr::vector<const double*> columns(m_Resource);
+	AlignedResource aligned(m_Resource);
+	Scratch broadcast(&aligned);
+
+	for (const std::string& variable : compiled.variables)
+	{
+		auto column = inputs.find(std::string_view(variable));
+
+		if (column != inputs.end() && column->second.size() >= output.size())
+		{
+			columns.push_back(column->second.data());
+			continue;
+		}
+
+		const long double* value = FindVariable(variable);
+
+		if (column != inputs.end() || !value)
+		{
+			m_State = column != inputs.end() ? State::InvalidInput : State::UnknownExpressionType;
+			return false;
+		}
+
+		broadcast.emplace_back(output.size(), (double)*value);
+		columns.push_back(broadcast.back().data());
+	}
+
+	compiled.batch(columns.data(), output.data(), output.size());
+	return true;
+}
+
+
+bool Parser::ParseToken(std::pmr::string& token)
+{
+	SkipSpace();
+
+	if (*m_Input == '\0')
+		return false;
+
+	size_t start = Tell();
+
+	if (std::isdigit(*m_Input))
+	{
+		while (std::isdigit(*m_Input) || *m_Input == '.')
+		{
+			token.push_back(*m_Input++);
+			Fill(start);
+		}
+
+		if (token.back() == '.')
+		{
+			m_State = State::InvalidSyntax;
+			return true;
+		}
+
+		return true;
+	}
+
+	// Names are matched against the buffer, so the whole word has to be read in first.
+	ScanWord();
+	Seek(start);
+
+	std::string_view match = MatchToken(m_Input);
+
+	if (match.empty())
+	{
+		m_State = State::InvalidSyntax;
+		return false;
+	}
+
+	m_Input += match.length();
+	token = match;
+
+	return !FindLocal(token) && FindConstant(token) != nullptr;
+}
+
+
+uint32_t Parser::ParseSimpleExpression(Expression& expr)
+{
+	std::pmr::string token(m_Resource);
+	bool isNumber = ParseToken(token);
+
+	if (!IsOk())
+		return 0;
+
+	if (token.empty())
+	{
+		m_State = State::InvalidSyntax;
+		return 0;
+	}
+
+	if (isNumber && std::isdigit(token[0]))
+		return expr.Push(Expression::Kind::Number, 0, 0, std::strtold(token.c_str(), nullptr));
+
+	if (const Local* local = FindLocal(token))
+		return expr.Push(Expression::Kind::Local, expr.Intern(token), local->node);
+
+	if (const Definition* definition = FindDefinition(token))
+		return ParseCall(expr, *definition);
+
+	if (isNumber || FindVariable(token))
+		return expr.Push(Expression::Kind::Name, expr.Intern(token));
+
+	if (token == "(")
+	{
+		const char* open = m_Input - 1;
+		uint32_t first = (uint32_t)expr.Size();
+		uint32_t result = ParseBinaryExpression(expr, 0);
+
+		token.clear();
+		isNumber = ParseToken(token);
+
+		if (token != ")")
+		{
+			m_State = State::InvalidSyntax;
+			return 0;
+		}
+
+		if (m_Groups)
+			m_Groups->push_back({ first, result, (uint32_t)(open - m_Begin), (uint32_t)(m_Input - m_Begin) });
+
+		return result;
+	}
+
+	uint32_t op = expr.Intern(token);
+	ParseSimpleExpression(expr);
+
+	return expr.Push(Expression::Kind::Unary, op);
+}
+
+
+uint32_t Parser::ParseStatement(Expression& expr)
+{
+	size_t start = Tell();
+
+	std::pmr::string token(m_Resource);
+	ParseToken(token);
+
+	if (IsOk() && token == "def")
+	{
+		ParseDefinition();
+		return 0;
+	}
+
+	if (!IsOk() || token != "let")
+	{
+		Seek(start);
+		m_State = State::Ok;
+
+		return ParseBinaryExpression(expr, 0);
+	}
+
+	Local local = { std::pmr::string(ParseIdentifier(), m_Resource), 0 };
+
+	if (!IsOk() || !Expect("="))
+		return 0;
+
+	ParseBinaryExpression(expr, 0);
+
+	if (!IsOk())
+		return 0;
+
+	local.node = expr.Push(Expression::Kind::Let, expr.Intern(local.name));
+	m_Locals->push_back(std::move(local));
+
+	return local.node;
+}
+
+
+bool Parser::ParseDefinition()
+{
+	std::pmr::string name(ParseIdentifier(), m_Resource);
+
+	if (!IsOk())
+		return false;
+
+	if (std::find(std::begin(TOKENS), std::end(TOKENS), name) != std::end(TOKENS) || FindBuiltinFunction(name) || FindConstant(name))
+	{
+		m_State = State::InvalidSyntax;
+		return false;
+	}
+
+	if (!Expect("("))
+		return false;
+
+	Definition definition;
+	std::pmr::vector<Local> parameters(m_Resource);
+
+	while (!Accept(")"))
+	{
+		if (!parameters.empty() && !Expect(","))
+			return false;
+
+		std::pmr::string parameter(ParseIdentifier(), m_Resource);
+
+		if (!IsOk())
+			return false;
+
+		definition.body.Push(Expression::Kind::Number);
+		parameters.push_back({ parameter, definition.body.Push(Expression::Kind::Let, definition.body.Intern(parameter)) });
+		definition.parameters.emplace_back(parameter);
+	}
+
+	if (!IsOk() || !Expect("="))
+		return false;
+
+	std::pmr::vector<Local>* locals = m_Locals;
+	std::pmr::vector<Document::Group>* groups = m_Groups;
+
+	m_Locals = &parameters;
+	m_Groups = nullptr;
+
+	ParseBinaryExpression(definition.body, 0);
+
+	m_Locals = locals;
+	m_Groups = groups;
+
+	if (!IsOk())
+		return false;
+
+	(*m_Definitions)[std::string(name)] = std::move(definition);
+
+	return true;
+}
+
+
+uint32_t Parser::ParseCall(Expression& expr, const Definition& definition)
+{
+	if (!Expect("("))
+		return 0;
+
+	std::pmr::vector<uint32_t> arguments(m_Resource);
+
+	for (const std::string& parameter : definition.parameters)
+	{
+		if (!arguments.empty() && !Expect(","))
+			return 0;
+
+		ParseBinaryExpression(expr, 0);
+
+		if (!IsOk())
+			return 0;
+
+		arguments.push_back(expr.Push(Expression::Kind::Let, expr.Intern(parameter)));
+	}
+
+	if (!Expect(")"))
+		return 0;
+
+	return Inline(expr, definition, arguments);
+}
+
+
+uint32_t Parser::Inline(Expression& expr, const Definition& definition, std::span<const uint32_t> arguments)
+{
+	const Expression& body = definition.body;
+
+	uint32_t base = (uint32_t)expr.Size();
+	uint32_t prefix = (uint32_t)arguments.size() * 2;
+
+	auto map = [&](uint32_t node)
+	{
+		return node < prefix ? arguments[node / 2] : base + node - prefix;
+	};
+
+	for (uint32_t node = prefix; node < body.Size(); node++)
+	{
+		Expression::Kind kind = body.kinds[node];
+		uint32_t op = kind == Expression::Kind::Number ? 0 : expr.Intern(body.symbols[body.ops[node]]);
+
+		expr.Push(kind, op, map(body.firstChildren[node]), body.values[node]);
+	}
+
+	return expr.Root();
+}
+
+
+std::string_view Parser::ParseIdentifier()
+{
+	SkipSpace();
+
+	std::string_view name = ScanWord();
+
+	if (name.empty() || std::isdigit(name[0]))
+		m_State = State::InvalidSyntax;
+
+	return name;
+}
+
+
+// Scans letters, digits and underscores, refilling the stream as it goes so a long word is never cut short.
+std::string_view Parser::ScanWord()
+{
+	size_t start = Tell();
+
+	while (std::isalnum(*m_Input) || *m_Input == '_')
+	{
+		m_Input++;
+		Fill(start);
+	}
+
+	const char* word = m_Begin + (start - m_Consumed);
+	return std::string_view(word, m_Input - word);
+}
+
+
+bool Parser::Accept(std::string_view expected)
+{
+	size_t start = Tell();
+
+	std::pmr::string token(m_Resource);
+	ParseToken(token);
+
+	if (!IsOk() || token != expected)
+	{
+		Seek(start);
+		m_State = State::Ok;
+
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Parser::Expect(std::string_view expected)
+{
+	if (!Accept(expected))
+	{
+		m_State = State::InvalidSyntax;
+		return false;
+	}
+
+	return true;
+}
+
+
+uint32_t Parser::ParseBinaryExpression(Expression& expr, int minPriority)
+{
+	uint32_t lhs = ParseSimpleExpression(expr);
+
+	while (IsOk())
+	{
+		std::pmr::string op(m_Resource);
+		ParseToken(op);
+
+		int priority = GetPriority(op);
+
+		if (priority <= minPriority)
+		{
+			m_Input -= op.size();
+			return lhs;
+		}
+
+		uint32_t symbol = expr.Intern(op);
+		ParseBinaryExpression(expr, priority);
+
+		lhs = expr.Push(Expression::Kind::Binary, symbol, lhs);
+	}
+
+	return lhs;
+}
+
+
+Parser::Bindings Parser::Bind(std::span<const std::pmr::string> symbols) const
+{
+	// Number nodes carry op 0, so keep one entry even when there are no symbols.
+	Bindings bindings(std::max<size_t>(symbols.size(), 1), m_Resource);
+
+	for (size_t i = 0; i < symbols.size(); i++)
+	{
+		std::string_view symbol = symbols[i];
+		Binding& binding = bindings[i];
+
+		binding.value = FindVariable(symbol);
+
+		if (!binding.value)
+		{
+			binding.value = FindConstant(symbol);
+			binding.constant = binding.value != nullptr;
+		}
+
+		binding.function = FindFunction(symbol);
+		binding.builtinFunction = FindBuiltinFunction(symbol);
+		binding.op = FindOperator(symbol);
+		binding.builtinOperator = FindBuiltinOperator(symbol);
+
+		if (binding.builtinOperator && symbol.length() == 1 && std::strchr("+-*/^", symbol[0]))
+			binding.arithmetic = symbol[0];
+	}
+
+	return bindings;
+}
+
+
+long double Parser::Evaluate(const Expression& expr)
+{
+	if (expr.Empty())
+	{
+		m_State = State::UnknownExpressionType;
+		return 0.0;
+	}
+
+	Bindings bindings = Bind(expr.symbols);
+	std::pmr::vector<long double> results(expr.Size(), m_Resource);
+
+	for (uint32_t node = 0; node < expr.Size() && IsOk(); node++)
+	{
+		uint32_t first = expr.firstChildren[node];
+
+		if (expr.kinds[node] == Expression::Kind::Let || expr.kinds[node] == Expression::Kind::Local)
+		{
+			results[node] = results[first];
+			continue;
+		}
+
+		results[node] = EvaluateNode(expr.kinds[node], bindings[expr.ops[node]], expr.values[node],
+			results[first], results[node > 0 ? node - 1 : 0], IsKnown(expr, bindings, first));
+	}
+
+	return results[expr.Root()];
+}
+
+
+long double Parser::EvaluateNode(Expression::Kind kind, const Binding& binding, long double value, long double a, long double b, bool knownBase)
+{
+	switch (kind)
+	{
+	case Expression::Kind::Number:
+		return value;
+
+	case Expression::Kind::Name:
+		if (binding.value)
+			return *binding.value;
+
+		m_State = State::UnknownExpressionType;
+		return 0.0;
+
+	case Expression::Kind::Unary:
+	{
+		if (binding.function && binding.function->handler)
+			return binding.function->handler(a);
+
+		if (binding.builtinFunction)
+			return CallBuiltin(*binding.builtinFunction, a);
+
+		if (binding.function)
+		{
+			double in = (double)a, out;
+			binding.function->kernel({ &in, 1 }, { &out, 1 });
+
+			return out;
+		}
+
+		m_State = State::UnknownUnaryOperator;
+		return 0.0;
+	}
+
+	case Expression::Kind::Binary:
+	{
+		if (binding.arithmetic == '^')
+			return EvaluatePower(a, b, knownBase);
+
+		if (binding.op)
+			return binding.op->handler(a, b);
+
+		if (binding.builtinOperator)
+			return binding.builtinOperator->handler(a, b);
+
+		m_State = State::UnknownBinaryOperator;
+		return 0.0;
+	}
+
+	default:
+		break;
+	}
+
+	return 0.0;
+}
+
+
+long double Parser::EvaluatePower(long double base, long double exponent, bool knownBase)
+{
+	if (knownBase)
+	{
+		if (base == std::numbers::e_v<long double>)
+			return expl(exponent);
+
+		if (base == 2.0L)
+			return exp2l(exponent);
+	}
+
+	return Power(ClassifyPower(base, exponent), base, exponent);
+}
+
+
+void Parser::EvaluateBlock(const Expression& expr, std::span<const uint8_t> statements, const Bindings& bindings, size_t offset, std::span<double> output, Scratch& scratch, Scratch& locals)
+{
+	size_t top = 0;
+
+	auto slot = [&](size_t index)
+	{
+		return index == 0 ? output : GetScratch(scratch, index - 1, output.size());
+	};
+
+	for (uint32_t node = 0; node < expr.Size() && IsOk(); node++)
+	{
+		Expression::Kind kind = expr.kinds[node];
+
+		if (kind == Expression::Kind::Let)
+		{
+			std::span<double> values = slot(--top);
+			std::span<double> local = GetScratch(locals, (size_t)expr.values[node], output.size());
+
+			std::copy(values.begin(), values.end(), local.begin());
+
+			if (node == expr.Root())
+				std::copy(values.begin(), values.end(), output.begin());
+
+			continue;
+		}
+
+		if (kind == Expression::Kind::Local)
+		{
+			std::span<double> local = GetScratch(locals, (size_t)expr.values[expr.firstChildren[node]], output.size());
+			std::span<double> values = slot(top++);
+
+			std::copy(local.begin(), local.end(), values.begin());
+		}
+		else
+		{
+			std::span<double> target;
+			std::span<double> rhs;
+
+			switch (kind)
+			{
+			case Expression::Kind::Number:
+			case Expression::Kind::Name: target = slot(top++); break;
+			case Expression::Kind::Unary: target = slot(top - 1); break;
+			case Expression::Kind::Binary: rhs = slot(--top); target = slot(top - 1); break;
+			default: break;
+			}
+
+			ApplyBlock(kind, bindings[expr.ops[node]], expr.values[node], offset, target, rhs, slot(top),
+				IsKnown(expr, bindings, expr.firstChildren[node]), IsKnown(expr, bindings, node > 0 ? node - 1 : 0));
+		}
+
+		// Only the last statement produces the output, so earlier ones must not stay on the stack.
+		if (statements[node] && node != expr.Root())
+			top--;
+	}
+}
+
+
+void Parser::EvaluateBlock(const Program& program, const Bindings& bindings, size_t offset, size_t count, Scratch& registers, Scratch* errors)
+{
+	std::span<double> temp = GetScratch(registers, program.registers, count);
+
+	for (const Program::Instruction& instruction : program.code)
+	{
+		if (errors)
+			EstimateError(instruction, bindings[instruction.op], count, registers, *errors);
+
+		std::span<double> target = GetScratch(registers, instruction.target, count);
+		std::span<double> lhs = GetScratch(registers, instruction.lhs, count);
+
+		bool operation = instruction.kind == Expression::Kind::Unary || instruction.kind == Expression::Kind::Binary;
+
+		if (operation && instruction.lhs != instruction.target)
+			std::copy(lhs.begin(), lhs.end(), target.begin());
+
+		if (instruction.table && program.tables[instruction.table - 1].radians == m_Radians)
+			ApplyTable(program.tables[instruction.table - 1], bindings[instruction.op], target);
+		else
+			ApplyBlock(instruction.kind, bindings[instruction.op], instruction.value, offset, target,
+				GetScratch(registers, instruction.rhs, count), temp, instruction.knownBase, instruction.knownExponent);
+
+		if (!IsOk())
+			return;
+	}
+}
+
+
+void Parser::EstimateError(const Program::Instruction& instruction, const Binding& binding, size_t count, Scratch& registers, Scratch& errors)
+{
+	// First-order relative error bound per row: every rounding adds an epsilon and sums scale their operands'
+	// errors by |a| + |b| over |a +- b|, which is where cancellation shows up.
+	constexpr double EPSILON = std::numeric_limits<double>::epsilon() / 2.0;
+
+	std::span<double> error = GetScratch(errors, instruction.target, count);
+	std::span<const double> a = GetScratch(registers, instruction.lhs, count);
+	std::span<const double> b = GetScratch(registers, instruction.rhs, count);
+	std::span<const double> ea = GetScratch(errors, instruction.lhs, count);
+	std::span<const double> eb = GetScratch(errors, instruction.rhs, count);
+
+	switch (instruction.kind)
+	{
+	case Expression::Kind::Number:
+		std::fill(error.begin(), error.end(), (long double)(double)instruction.value == instruction.value ? 0.0 : EPSILON);
+		break;
+
+	case Expression::Kind::Name:
+		std::fill(error.begin(), error.end(), binding.column ? 0.0 : EPSILON);
+		break;
+
+	case Expression::Kind::Unary:
+	{
+		// Functions scale their argument's error by their condition number, e.g. ln near 1 or tan near a pole.
+		double (*condition)(double) = binding.function || !binding.builtinFunction ? nullptr : FindCondition(binding.builtinFunction->name);
+		double scale = binding.builtinFunction && binding.builtinFunction->angle == Angle::Argument && !m_Radians ? std::numbers::pi / 180.0 : 1.0;
+
+		for (size_t i = 0; i < count; i++)
+			error[i] = (ea[i] == 0.0 ? 0.0 : (condition ? condition(a[i] * scale) : 1.0) * ea[i]) + EPSILON;
+		break;
+	}
+
+	case Expression::Kind::Binary:
+		switch (binding.arithmetic)
+		{
+		case '+':
+		case '-':
+			for (size_t i = 0; i < count; i++)
+			{
+				double sum = std::fabs(binding.arithmetic == '+' ? a[i] + b[i] : a[i] - b[i]);
+				double spread = std::fabs(a[i]) * ea[i] + std::fabs(b[i]) * eb[i];
+
+				error[i] = (spread == 0.0 ? 0.0 : spread / sum) + EPSILON;
+			}
+			break;
+
+		case '^':
+			for (size_t i = 0; i < count; i++)
+			{
+				double exponent = eb[i] == 0.0 ? 0.0 : std::fabs(std::log(std::fabs(a[i]))) * eb[i];
+				error[i] = std::fabs(b[i]) * (ea[i] + exponent) + EPSILON;
+			}
+			break;
+
+		default:
+			for (size_t i = 0; i < count; i++)
+				error[i] = ea[i] + eb[i] + EPSILON;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+// |x f'(x) / f(x)| for builtin functions that change relative errors; the others pass them through unchanged.
+double (*Parser::FindCondition(std::string_view name))(double)
+{
+	static constexpr std::pair<std::string_view, double (*)(double)> CONDITIONS[] =
+	{
+		{ "ln", [](double x) { return 1.0 / std::fabs(std::log(x)); } },
+		{ "lg", [](double x) { return 1.0 / std::fabs(std::log(x)); } },
+		{ "log2", [](double x) { return 1.0 / std::fabs(std::log(x)); } },
+		{ "sin", [](double x) { return x == 0.0 ? 1.0 : std::fabs(x / std::tan(x)); } },
+		{ "cos", [](double x) { return std::fabs(x * std::tan(x)); } },
+		{ "tan", [](double x) { return x == 0.0 ? 1.0 : std::fabs(2.0 * x / std::sin(2.0 * x)); } },
+		{ "asin", [](double x) { return x == 0.0 ? 1.0 : std::fabs(x / (std::sqrt(1.0 - x * x) * std::asin(x))); } },
+		{ "acos", [](double x) { return std::fabs(x / (std::sqrt(1.0 - x * x) * std::acos(x))); } },
+		{ "atan", [](double x) { return x == 0.0 ? 1.0 : std::fabs(x / ((1.0 + x * x) * std::atan(x))); } },
+		{ "sqrt", [](double) { return 0.5; } },
+		{ "!", [](double x)
+		{
+			// x times the digamma function at x + 1, from a central difference of lgamma.
+			double h = 1e-5 * std::max(1.0, std::fabs(x));
+			return std::fabs(x * (std::lgamma(x + 1.0 + h) - std::lgamma(x + 1.0 - h)) / (2.0 * h));
+		} }
+	};
+
+	for (const auto& [function, condition] : CONDITIONS)
+		if (function == name)
+			return condition;
+
+	return nullptr;
+}
+
+void Parser::EvaluateRow(const Program& program, const Bindings& bindings, size_t row, std::span<long double> registers)
+{
+	for (const Program::Instruction& instruction : program.code)
+	{
+		const Binding& binding = bindings[instruction.op];
+
+		if (instruction.kind == Expression::Kind::Name && binding.column)
+			registers[instruction.target] = (*binding.column)[row];
+		else
+			registers[instruction.target] = EvaluateNode(instruction.kind, binding, instruction.value,
+				registers[instruction.lhs], registers[instruction.rhs], instruction.knownBase);
+
+		if (!IsOk())
+			return;
+	}
+}
+
+
+bool Parser::BuildTable(const Binding& binding, Range range, double tolerance, Program::LookupTable& table)
+{
+	// Sizing compares the exact function with the table at interval midpoints, where linear interpolation error
+	// peaks for smooth functions; the accepted size is verified at the quarter points as well. Too large an error
+	// grows the table by the square root of the excess, since the error falls with the square of the step.
+	auto exact = [&](long double x)
+	{
+		return EvaluateNode(Expression::Kind::Unary, binding, 0.0L, x, 0.0L, false);
+	};
+
+	for (size_t size = TABLE_MIN_SIZE;;)
+	{
+		long double step = (range.high - range.low) / size;
+
+		auto measure = [&](std::initializer_list<double> fractions)
+		{
+			double error = 0.0;
 
-private:
-	bool ParseToken(std::string& token);
+			for (size_t i = 0; i < size; i++)
+			{
+				for (double fraction : fractions)
+				{
+					long double y = exact(range.low + step * (i + fraction));
 
-	Expression ParseSimpleExpression();
-	Expression ParseBinaryExpression(int minPriority);
+					if (!std::isfinite(y) || !IsOk())
+						return std::numeric_limits<double>::quiet_NaN();
 
-	long double Evaluate(const Expression& expr);
+					error = std::max(error, (double)std::fabs(y - (table.values[i] + fraction * (table.values[i + 1] - table.values[i]))));
+				}
+			}
 
-	int GetPriority(std::string_view binaryOp);
+			return error;
+		};
 
-private:
-	State m_State = State::Ok;
+		table.values.resize(size + 1);
 
-	char* m_Input;
-	bool m_Radians;
+		for (size_t i = 0; i <= size; i++)
+		{
+			table.values[i] = (double)exact(range.low + step * i);
 
-	std::list<std::string_view> TOKENS = {
-		"+", "-", "^", "*", "/", "%", "(", ")", "!", "e", "lg", "ln", "pi", "abs", "sin", "cos", "tan",
-		"sqrt", "asin", "acos", "atan", "log2"
-	};
+			if (!std::isfinite(table.values[i]) || !IsOk())
+				return false;
+		}
 
-	std::unordered_map<std::string_view, std::string> CONSTANTS =
-	{
-		{ "pi", std::to_string(std::numbers::pi) },
-		{ "e", std::to_string(std::numbers::e) }
-	};
+		double error = measure({ 0.5 });
 
-	std::unordered_map<std::string, std::function<long double(long double)>> FUNCTIONS =
-	{
-		{ "+", [](long double a) { return a; } },
-		{ "-", [](long double a) { return -a; } },
-		{ "abs", [&](long double a) { return abs(a); } },
-		{ "log2", [&](long double a) { return log2(a); } },
-		{ "lg", [&](long double a) { return log10(a); } },
-		{ "ln", [&](long double a) { return log(a); } },
-		{ "sin", [&](long double a) { return m_Radians ? sin(a) : sin(a * std::numbers::pi / 180.0); } },
-		{ "cos", [&](long double a) { return m_Radians ? cos(a) : cos(a * std::numbers::pi / 180.0); } },
-		{ "tan", [&](long double a) { return m_Radians ? tan(a) : tan(a * std::numbers::pi / 180.0); } },
-		{ "asin", [&](long double a) { return m_Radians ? asin(a) : asin(a) / std::numbers::pi * 180.0; } },
-		{ "acos", [&](long double a) { return m_Radians ? acos(a) : acos(a) / std::numbers::pi * 180.0; } },
-		{ "atan", [&](long double a) { return m_Radians ? atan(a) : atan(a) / std::numbers::pi * 180.0; } },
-		{ "sqrt", [&](long double a) { return sqrt(a); } },
-		{ "!", [&](long double a) { return tgamma(a + 1.0L); } }
-	};
+		if (error <= tolerance)
+			error = std::max(error, measure({ 0.25, 0.75 }));
 
-	std::unordered_map<std::string, std::function<long double(long double, long double)>> OPERATORS =
-	{
-		{ "+", [](long double a, long double b) { return a + b; } },
-		{ "-", [](long double a, long double b) { return a - b; } },
-		{ "*", [](long double a, long double b) { return a * b; } },
-		{ "/", [](long double a, long double b) { return a / b; } },
-		{ "^", [](long double a, long double b) { return pow(a, b); } },
-		{ "%", [](long double a, long double b) { return (long int)a % (long int)b; } }
-	};
+		if (std::isnan(error))
+			return false;
 
-};
+		if (error <= tolerance)
+		{
+			table.low = (double)range.low;
+			table.high = (double)range.high;
+			table.scale = size / (table.high - table.low);
+			table.error = error;
 
-#ifdef PARSER_IMPL
-#undef PARSER_IMPL
+			return true;
+		}
 
+		if (size == TABLE_MAX_SIZE)
+			return false;
 
-Expression::Expression(std::string_view token) : token(token)
-{
+		double estimate = size * std::sqrt(error / tolerance) * 1.25;
+		size = (size_t)std::min<double>(TABLE_MAX_SIZE, std::max<double>(size * 2.0, estimate));
+	}
 }
 
-Expression::Expression(std::string_view token, const Expression& rhs) : token(token), arguments{rhs}
+void Parser::ApplyTable(const Program::LookupTable& table, const Binding& binding, std::span<double> target)
 {
+	double last = (double)(table.values.size() - 1);
+
+	for (double& x : target)
+	{
+		double t = (x - table.low) * table.scale;
+
+		// Arguments outside the analysed range, including NaN, fall back to the function itself.
+		if (t >= 0.0 && t <= last)
+		{
+			size_t i = std::min((size_t)t, table.values.size() - 2);
+			double fraction = t - (double)i;
+
+			x = table.values[i] + fraction * (table.values[i + 1] - table.values[i]);
+		}
+		else
+			x = (double)EvaluateNode(Expression::Kind::Unary, binding, 0.0L, x, 0.0L, false);
+	}
 }
 
-Expression::Expression(std::string_view token, const Expression& lhs, const Expression& rhs) : token(token), arguments{lhs, rhs}
+Parser::Range Parser::Combine(char arithmetic, Range a, Range b)
 {
-}
+	static constexpr long double INF = std::numeric_limits<long double>::infinity();
 
+	auto hull = [](std::initializer_list<long double> values)
+	{
+		Range range = { INF, -INF };
 
+		for (long double value : values)
+		{
+			if (std::isnan(value))
+				return Range{ -INF, INF };
 
-Parser::Parser()
-{
+			range = { std::min(range.low, value), std::max(range.high, value) };
+		}
 
-}
+		return range;
+	};
 
+	switch (arithmetic)
+	{
+	case '+': return hull({ a.low + b.low, a.high + b.high });
+	case '-': return hull({ a.low - b.high, a.high - b.low });
+	case '*': return hull({ a.low * b.low, a.low * b.high, a.high * b.low, a.high * b.high });
 
-Parser::~Parser()
-{
+	case '/':
+		if (b.low <= 0.0L && b.high >= 0.0L)
+			break;
+
+		return hull({ a.low / b.low, a.low / b.high, a.high / b.low, a.high / b.high });
+
+	case '^':
+		// For a positive base the extremes lie on the corners; an integer exponent also allows any base.
+		if (a.low > 0.0L)
+			return hull({ std::pow(a.low, b.low), std::pow(a.low, b.high), std::pow(a.high, b.low), std::pow(a.high, b.high) });
+
+		if (b.low == b.high && b.low == std::trunc(b.low) && (b.low >= 0.0L || a.high < 0.0L))
+		{
+			bool zero = a.low <= 0.0L && a.high >= 0.0L;
+			return hull({ std::pow(a.low, b.low), std::pow(a.high, b.low), zero ? std::pow(0.0L, b.low) : std::pow(a.low, b.low) });
+		}
+		break;
+	}
+
+	return { -INF, INF };
 }
 
 
-long double Parser::Get(std::string input, bool radians)
+int64_t Parser::EvaluateFixedNode(const Program::Instruction& instruction, const Binding& binding, FixedPoint& fixed, int64_t a, int64_t b)
 {
-	for (auto& c : input)
+	if (instruction.kind == Expression::Kind::Unary)
 	{
-		if (isalpha(c))
-			c = tolower(c);
-	}
+		int64_t result;
 
-	m_Input = (char*)input.c_str();
-	m_Radians = radians;
+		if (binding.function || !binding.builtinFunction)
+		{
+			m_State = State::UnknownUnaryOperator;
+			return 0;
+		}
 
-	m_State = State::Ok;
+		if (!m_Radians && binding.builtinFunction->angle == Angle::Argument)
+			a = fixed.ToRadians(a);
 
-	long double result = Evaluate(ParseBinaryExpression(0));
-	m_Input = nullptr;
+		if (!fixed.Call(binding.builtinFunction->name, a, result))
+		{
+			m_State = State::UnknownUnaryOperator;
+			return 0;
+		}
 
-	return result;
+		return !m_Radians && binding.builtinFunction->angle == Angle::Result ? fixed.ToDegrees(result) : result;
+	}
+
+	switch (binding.arithmetic)
+	{
+	case '+': return fixed.Add(a, b);
+	case '-': return fixed.Subtract(a, b);
+	case '*': return fixed.Multiply(a, b);
+	case '/': return fixed.Divide(a, b);
+	case '^': return fixed.Power(a, b);
+	}
+
+	if (!binding.op && binding.builtinOperator && binding.builtinOperator->name == "%")
+		return fixed.Modulo(a, b);
+
+	m_State = State::UnknownBinaryOperator;
+	return 0;
 }
 
 
-bool Parser::ParseToken(std::string& token)
+void Parser::ApplyBlock(Expression::Kind kind, const Binding& binding, long double value, size_t offset,
+	std::span<double> target, std::span<const double> rhs, std::span<double> temp, bool knownBase, bool knownExponent)
 {
-	while (std::isspace(*m_Input))
-		m_Input++;
+	switch (kind)
+	{
+	case Expression::Kind::Number:
+		std::fill(target.begin(), target.end(), (double)value);
+		break;
 
-	if (*m_Input == '\0')
-		return false;
+	case Expression::Kind::Name:
+		if (binding.column)
+			std::copy_n(binding.column->begin() + offset, target.size(), target.begin());
+		else if (binding.value)
+			std::fill(target.begin(), target.end(), (double)*binding.value);
+		else
+			m_State = State::UnknownExpressionType;
+		break;
 
-	if (std::isdigit(*m_Input))
-	{
-		while (std::isdigit(*m_Input) || *m_Input == '.')
-			token.push_back(*m_Input++);
+	case Expression::Kind::Unary:
+		if (binding.function && binding.function->kernel)
+		{
+			std::span<double> in = temp.first(target.size());
+			std::copy(target.begin(), target.end(), in.begin());
 
-		if (token.back() == '.')
+			binding.function->kernel(in, target);
+		}
+		else if (binding.function && binding.function->handler)
 		{
-			m_State = State::InvalidSyntax;
-			return true;
+			for (auto& x : target)
+				x = (double)binding.function->handler(x);
 		}
+		else if (binding.builtinFunction)
+		{
+			for (auto& x : target)
+				x = (double)CallBuiltin(*binding.builtinFunction, x);
+		}
+		else
+			m_State = State::UnknownUnaryOperator;
+		break;
 
-		return true;
-	}
-
-	for (auto t = TOKENS.crbegin(); t != TOKENS.crend(); t++)
-		if (std::strncmp(m_Input, t->data(), t->length()) == 0)
+	case Expression::Kind::Binary:
+		switch (binding.arithmetic)
 		{
-			m_Input += t->length();
+		case '+': for (size_t i = 0; i < target.size(); i++) target[i] += rhs[i]; break;
+		case '-': for (size_t i = 0; i < target.size(); i++) target[i] -= rhs[i]; break;
+		case '*': for (size_t i = 0; i < target.size(); i++) target[i] *= rhs[i]; break;
+		case '/': for (size_t i = 0; i < target.size(); i++) target[i] /= rhs[i]; break;
+		case '^': EvaluatePowerBlock(target, rhs, knownBase, knownExponent); break;
 
-			if (CONSTANTS.contains(*t))
+		default:
+			if (binding.op && binding.op->kernel)
+				binding.op->kernel(target, rhs);
+			else if (binding.op)
 			{
-				token = CONSTANTS[*t];
-				return true;
+				for (size_t i = 0; i < target.size(); i++)
+					target[i] = (double)binding.op->handler(target[i], rhs[i]);
 			}
-
-			token = t->data();
-			return false;
+			else if (binding.builtinOperator)
+			{
+				for (size_t i = 0; i < target.size(); i++)
+					target[i] = (double)binding.builtinOperator->handler(target[i], rhs[i]);
+			}
+			else
+				m_State = State::UnknownBinaryOperator;
 		}
+		break;
 
-	m_State = State::InvalidSyntax;
-	return false;
+	default:
+		break;
+	}
 }
 
 
-Expression Parser::ParseSimpleExpression()
+void Parser::EvaluatePowerBlock(std::span<double> base, std::span<const double> exponent, bool knownBase, bool knownExponent)
 {
-	std::string token;
-	bool isNumber = ParseToken(token);
+	if (knownBase && (base[0] == std::numbers::e || base[0] == 2.0))
+	{
+		bool binary = base[0] == 2.0;
 
-	if (!IsOk())
-		return {};
+		for (size_t i = 0; i < base.size(); i++)
+			base[i] = binary ? exp2(exponent[i]) : exp(exponent[i]);
 
-	if (isNumber)
-		return Expression(token);
+		return;
+	}
 
-	if (token == "(")
+	if (knownExponent)
 	{
-		Expression result = ParseBinaryExpression(0);
-
-		token.clear();
-		isNumber = ParseToken(token);
+		PowerKind kind = ClassifyPower(NAN, exponent[0]);
 
-		if (token != ")")
+		if (kind != PowerKind::Generic)
 		{
-			m_State = State::InvalidSyntax;
-			return {};
+			for (size_t i = 0; i < base.size(); i++)
+				base[i] = (double)Power(kind, base[i], exponent[i]);
+
+			return;
 		}
+	}
 
-		return result;
+	for (size_t i = 0; i < base.size(); i++)
+		base[i] = (double)Power(ClassifyPower(base[i], exponent[i]), base[i], exponent[i]);
+}
+
+
+double Parser::Sum(std::span<const double> values)
+{
+	// Pairwise summation with a split that depends only on the length.
+	if (values.size() <= 8)
+	{
+		double sum = 0.0;
+
+		for (double value : values)
+			sum += value;
+
+		return sum;
 	}
 
-	return Expression(token, ParseSimpleExpression());
+	size_t half = values.size() / 2;
+	return Sum(values.first(half)) + Sum(values.subspan(half));
+}
+
+std::span<double> Parser::GetScratch(Scratch& scratch, size_t index, size_t count)
+{
+	if (scratch.size() <= index)
+		scratch.resize(index + 1);
+
+	if (scratch[index].size() < count)
+		scratch[index].resize(BLOCK_SIZE);
+
+	return { scratch[index].data(), count };
 }
 
 
-Expression Parser::ParseBinaryExpression(int minPriority)
+Parser::PowerKind Parser::ClassifyPower(long double base, long double exponent)
 {
-	Expression lhs = ParseSimpleExpression();
+	if (exponent == std::trunc(exponent) && std::fabs(exponent) <= MAX_INTEGER_EXPONENT)
+		return exponent == 1.0L ? PowerKind::Identity : PowerKind::Integer;
 
-	while (1)
-	{
-		std::string op;
-		bool isNumber = ParseToken(op);
+	if (exponent == 0.5L) return PowerKind::Sqrt;
+	if (exponent == -0.5L) return PowerKind::InverseSqrt;
+	// Batch exponents arrive as doubles, whose 1/3 is a different number from the long double one.
+	if ((exponent == 1.0L / 3.0L || exponent == (long double)(1.0 / 3.0)) && base >= 0.0L) return PowerKind::Cbrt;
 
-		int priority = GetPriority(op);
+	if (base == 2.0L) return PowerKind::Exp2;
+	if (base == std::numbers::e_v<long double>) return PowerKind::Exp;
 
-		if (priority <= minPriority)
-		{
-			m_Input -= op.size();
-			return lhs;
-		}
+	return PowerKind::Generic;
+}
 
-		Expression rhs = ParseBinaryExpression(priority);
-		lhs = Expression(op, lhs, rhs);
+
+long double Parser::Power(PowerKind kind, long double base, long double exponent)
+{
+	switch (kind)
+	{
+	case PowerKind::Integer: return IntegerPower(base, (long long)exponent);
+	case PowerKind::Identity: return base;
+	// pow takes zeros and infinities to +0 or +inf where sqrt and cbrt would keep the sign or give NaN.
+	case PowerKind::Sqrt: return base == 0.0L || std::isinf(base) ? std::fabs(base) : sqrtl(base);
+	case PowerKind::InverseSqrt: return base == 0.0L || std::isinf(base) ? 1.0L / std::fabs(base) : 1.0L / sqrtl(base);
+	case PowerKind::Cbrt: return base == 0.0L ? 0.0L : cbrtl(base);
+	case PowerKind::Exp: return expl(exponent);
+	case PowerKind::Exp2: return exp2l(exponent);
+	default: return powl(base, exponent);
 	}
 }
 
 
-long double Parser::Evaluate(const Expression& expr)
+long double Parser::IntegerPower(long double base, long long exponent)
 {
-	switch (expr.arguments.size())
-	{
-	case 2:
-	{
-		if (OPERATORS.contains(expr.token))
-		{
-			return OPERATORS[expr.token](
-				Evaluate(expr.arguments[0]),
-				Evaluate(expr.arguments[1]));
-		}
+	bool inverse = exponent < 0;
+	unsigned long long n = inverse ? -exponent : exponent;
 
-		m_State = State::UnknownBinaryOperator;
-	}
-	break;
+	long double result = 1.0L;
 
-	case 1:
+	while (n > 0)
 	{
-		if (FUNCTIONS.contains(expr.token))
-		{
-			return FUNCTIONS[expr.token](
-				Evaluate(expr.arguments[0]));
-		}
+		if (n & 1)
+			result *= base;
 
-		m_State = State::UnknownUnaryOperator;
+		base *= base;
+		n >>= 1;
 	}
-	break;
 
-	case 0:
-		if (expr.token.empty() || std::find_if(expr.token.begin(),
-			expr.token.end(), [](char c) { return !std::isdigit(c) && c != '.'; }) != expr.token.end())
-		{
-			m_State = State::UnknownExpressionType;
-			return 0.0;
-		}
+	return inverse ? 1.0L / result : result;
+}
+
+
+bool Parser::IsKnown(const Expression& expr, const Bindings& bindings, uint32_t node)
+{
+	return IsKnown(expr.kinds[node], bindings[expr.ops[node]]);
+}
 
-		return std::stold(expr.token);
+
+bool Parser::IsKnown(Expression::Kind kind, const Binding& binding)
+{
+	switch (kind)
+	{
+	case Expression::Kind::Number: return true;
+	case Expression::Kind::Name: return binding.constant;
+	default: return false;
 	}
 }
 
@@ -311,32 +5130,230 @@ bool Parser::IsOk() const
 	return m_State == State::Ok;
 }
 
-void Parser::AddOperator(std::string_view text, const std::function<long double(long double, long double)>& handler)
+std::pmr::memory_resource* Parser::GetResource() const
+{
+	return m_Resource;
+}
+
+void Parser::SetResource(std::pmr::memory_resource* resource)
+{
+	m_Resource = resource;
+}
+
+void Parser::RegisterOperator(std::string_view text, BinaryHandler handler, BinaryKernel kernel)
+{
+	if (FindBuiltinOperator(text))
+		return;
+
+	GetRegistry().operators.insert({ std::string(text), { std::move(handler), kernel } });
+	InsertToken(text);
+}
+
+void Parser::RegisterFunction(std::string_view text, UnaryHandler handler, Kernel kernel)
+{
+	if (FindBuiltinFunction(text))
+		return;
+
+	Function& function = GetRegistry().functions[std::string(text)];
+
+	if (!function.handler)
+		function.handler = std::move(handler);
+
+	if (!function.kernel)
+		function.kernel = std::move(kernel);
+
+	InsertToken(text);
+}
+
+void Parser::AddConstant(std::string_view text, long double value)
+{
+	for (const BuiltinConstant& constant : CONSTANTS)
+		if (constant.name == text)
+			return;
+
+	GetRegistry().constants.insert({ std::string(text), value });
+	InsertToken(text);
+}
+
+void Parser::AddVariable(std::string_view text, long double value)
+{
+	GetRegistry().variables.insert({ std::string(text), value });
+	InsertToken(text);
+}
+
+void Parser::SetVariable(std::string_view text, long double value)
+{
+	GetRegistry().variables[std::string(text)] = value;
+}
+
+void Parser::SetRange(std::string_view text, long double low, long double high)
+{
+	GetRegistry().ranges[std::string(text)] = { std::min(low, high), std::max(low, high) };
+}
+
+// Keywords, constants, functions, operators and definitions: names a variable must not take over.
+bool Parser::IsReserved(std::string_view name) const
+{
+	if (std::find(std::begin(TOKENS), std::end(TOKENS), name) != std::end(TOKENS))
+		return true;
+
+	return FindConstant(name) || FindFunction(name) || FindOperator(name) || FindDefinition(name) ||
+		FindBuiltinFunction(name) || FindBuiltinOperator(name);
+}
+
+Parser::Registry& Parser::GetRegistry()
+{
+	if (!m_Registry)
+		m_Registry = std::make_shared<Registry>();
+	else if (m_Registry.use_count() > 1)
+		m_Registry = std::make_shared<Registry>(*m_Registry);
+
+	// Every mutation goes through here, so documents can tell that their cached values are stale.
+	m_Registry->generation = ++s_Generation;
+
+	return *m_Registry;
+}
+
+void Parser::InsertToken(std::string_view text)
+{
+	std::vector<std::string>& tokens = GetRegistry().tokens;
+
+	if (std::find(tokens.begin(), tokens.end(), text) == tokens.end())
+		tokens.emplace_back(text);
+}
+
+std::string_view Parser::MatchToken(const char* input) const
 {
-	OPERATORS.insert({ text.data(), handler});
+	std::string_view match;
+
+	for (std::string_view t : TOKENS)
+		if (t.length() > match.length() && std::strncmp(input, t.data(), t.length()) == 0)
+			match = t;
+
+	if (m_Registry)
+	{
+		for (std::string_view t : m_Registry->tokens)
+			if (t.length() > match.length() && std::strncmp(input, t.data(), t.length()) == 0)
+				match = t;
+	}
+
+	if (m_Definitions)
+	{
+		for (const auto& [name, definition] : *m_Definitions)
+			if (name.length() > match.length() && std::strncmp(input, name.data(), name.length()) == 0)
+				match = name;
+	}
+
+	if (m_Locals)
+	{
+		for (const Local& local : *m_Locals)
+			if (local.name.length() > match.length() && std::strncmp(input, local.name.data(), local.name.length()) == 0)
+				match = local.name;
+	}
 
-	for (auto it = TOKENS.begin(); it != TOKENS.end(); it++)
+	return match;
+}
+
+const Parser::Definition* Parser::FindDefinition(std::string_view name) const
+{
+	if (m_Definitions)
 	{
-		if (it->length() > text.length())
-			TOKENS.insert(it, text);
+		auto it = m_Definitions->find(name);
+
+		if (it != m_Definitions->end())
+			return &it->second;
 	}
+
+	if (!m_Registry)
+		return nullptr;
+
+	auto it = m_Registry->definitions.find(name);
+	return it != m_Registry->definitions.end() ? &it->second : nullptr;
 }
 
-void Parser::AddFunction(std::string_view text, const std::function<long double(long double)>& handler)
+const Parser::Local* Parser::FindLocal(std::string_view name) const
 {
-	FUNCTIONS.insert({ text.data(), handler});
-	TOKENS.push_back(text);
+	if (!m_Locals)
+		return nullptr;
+
+	for (auto it = m_Locals->rbegin(); it != m_Locals->rend(); it++)
+		if (it->name == name)
+			return &*it;
+
+	return nullptr;
+}
 
-	for (auto it = TOKENS.begin(); it != TOKENS.end(); it++)
+const long double* Parser::FindConstant(std::string_view name) const
+{
+	if (m_Registry)
 	{
-		if (it->length() > text.length())
-			TOKENS.insert(it, text);
+		auto it = m_Registry->constants.find(name);
+
+		if (it != m_Registry->constants.end())
+			return &it->second;
 	}
+
+	for (const BuiltinConstant& constant : CONSTANTS)
+		if (constant.name == name)
+			return &constant.value;
+
+	return nullptr;
 }
 
-void Parser::AddConstant(std::string_view text, long double value)
+const long double* Parser::FindVariable(std::string_view name) const
+{
+	if (!m_Registry)
+		return nullptr;
+
+	auto it = m_Registry->variables.find(name);
+	return it != m_Registry->variables.end() ? &it->second : nullptr;
+}
+
+const Parser::Function* Parser::FindFunction(std::string_view name) const
+{
+	if (!m_Registry)
+		return nullptr;
+
+	auto it = m_Registry->functions.find(name);
+	return it != m_Registry->functions.end() ? &it->second : nullptr;
+}
+
+const Parser::Operator* Parser::FindOperator(std::string_view name) const
+{
+	if (!m_Registry)
+		return nullptr;
+
+	auto it = m_Registry->operators.find(name);
+	return it != m_Registry->operators.end() ? &it->second : nullptr;
+}
+
+const Parser::BuiltinFunction* Parser::FindBuiltinFunction(std::string_view name)
+{
+	for (const BuiltinFunction& function : FUNCTIONS)
+		if (function.name == name)
+			return &function;
+
+	return nullptr;
+}
+
+const Parser::BuiltinOperator* Parser::FindBuiltinOperator(std::string_view name)
+{
+	for (const BuiltinOperator& op : OPERATORS)
+		if (op.name == name)
+			return &op;
+
+	return nullptr;
+}
+
+long double Parser::CallBuiltin(const BuiltinFunction& function, long double a) const
 {
-	CONSTANTS.insert({ text, std::to_string(value) });
+	if (m_Radians || function.angle == Angle::None)
+		return function.handler(a);
+
+	if (function.angle == Angle::Argument)
+		return function.handler(a * std::numbers::pi_v<long double> / 180.0L);
+
+	return function.handler(a) / std::numbers::pi_v<long double> * 180.0L;
 }
 
 #endif
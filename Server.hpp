@@ -0,0 +1,718 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "Parser.hpp"
+
+#include <atomic>
+#include <list>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+/*
+* Frames are length-prefixed and use the host byte order.
+*
+* Request:  u32 size, u32 id, u8 flags (bit 0 = radians), u32 rows, u16 formula length, u16 variable count,
+*           formula, { u16 name length, name } per variable, rows doubles per variable
+* Response: u32 size, u32 id, u8 state, u32 rows, rows doubles
+*
+* Responses carry the request id and may be reordered within a connection.
+*/
+class Server
+{
+public:
+	struct Response
+	{
+		uint32_t id;
+		Parser::State state;
+		std::vector<double> values;
+	};
+
+	Server(Parser& parser);
+	~Server();
+
+	bool Listen(std::string_view path);
+	bool ListenMetrics(std::string_view address);
+	void Run();
+	void Stop();
+
+	static int Connect(std::string_view path);
+
+	static void EncodeRequest(std::string& output, uint32_t id, std::string_view formula, bool radians, uint32_t rows,
+		std::span<const std::string_view> names, std::span<const std::span<const double>> columns);
+
+	static bool DecodeResponse(std::string_view& input, Response& response);
+
+	static constexpr size_t MAX_FRAME_SIZE = 64 << 20;
+	static constexpr size_t CACHE_CAPACITY = 4096;
+
+private:
+	struct Connection
+	{
+		int fd;
+		std::string input;
+		std::string output;
+		bool metrics = false;
+		bool closing = false;
+		bool closed = false;
+	};
+
+	struct Request
+	{
+		size_t connection = 0;
+		uint32_t id = 0;
+		bool radians = false;
+		uint32_t rows = 0;
+		std::string_view formula;
+		std::vector<std::string_view> names;
+		const char* data = nullptr;
+	};
+
+	struct Entry
+	{
+		Expression canonical;
+		Program program;
+		size_t texts = 0;
+	};
+
+	struct Text
+	{
+		uint64_t hash;
+		Entry* entry;
+		std::list<std::string>::iterator recent;
+	};
+
+	void Accept(int socket, bool metrics);
+	void Receive(size_t index);
+	void ServeMetrics(Connection& connection);
+	void Send(Connection& connection);
+
+	size_t ParseRequests(size_t index, std::vector<Request>& requests);
+	void Dispatch(std::vector<Request>& requests);
+
+	const Program* Find(const Request& request, Parser::State& state);
+	void Evict(size_t incoming);
+	bool IsColumn(std::string_view name) const;
+
+	template <typename T>
+	static void WriteValue(std::string& output, T value);
+
+	template <typename T>
+	static T ReadValue(const char*& input);
+
+	void Respond(const Request& request, Parser::State state, std::span<const double> values);
+
+	Parser& m_Parser;
+
+	int m_Socket = -1;
+	std::string m_Path;
+
+	int m_MetricsSocket = -1;
+	std::string m_MetricsPath;
+	std::atomic<bool> m_Running = false;
+
+	std::vector<Connection> m_Connections;
+
+	// Formula texts, with their column names, map to programs shared by every text with the same canonical form.
+	std::unordered_map<std::string, Text> m_Texts;
+	std::unordered_multimap<uint64_t, Entry> m_Programs;
+	std::list<std::string> m_Recent;
+};
+
+template <typename T>
+void Server::WriteValue(std::string& output, T value)
+{
+	output.append((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+T Server::ReadValue(const char*& input)
+{
+	T value;
+	std::memcpy(&value, input, sizeof(T));
+	input += sizeof(T);
+
+	return value;
+}
+
+#ifdef SERVER_IMPL
+
+Server::Server(Parser& parser) : m_Parser(parser)
+{
+
+}
+
+Server::~Server()
+{
+	for (Connection& connection : m_Connections)
+		close(connection.fd);
+
+	if (m_Socket >= 0)
+	{
+		close(m_Socket);
+		unlink(m_Path.c_str());
+	}
+
+	if (m_MetricsSocket >= 0)
+	{
+		close(m_MetricsSocket);
+
+		if (!m_MetricsPath.empty())
+			unlink(m_MetricsPath.c_str());
+	}
+}
+
+bool Server::Listen(std::string_view path)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+
+	std::memcpy(address.sun_path, path.data(), path.size());
+
+	m_Path = path;
+	unlink(m_Path.c_str());
+
+	m_Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (m_Socket < 0 || bind(m_Socket, (sockaddr*)&address, sizeof(address)) < 0 || listen(m_Socket, SOMAXCONN) < 0)
+		return false;
+
+	fcntl(m_Socket, F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+bool Server::ListenMetrics(std::string_view address)
+{
+	if (!address.empty() && address.find_first_not_of("0123456789") == std::string_view::npos)
+	{
+		sockaddr_in local{};
+		local.sin_family = AF_INET;
+		local.sin_port = htons((uint16_t)std::stoi(std::string(address)));
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		m_MetricsSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+		int reuse = 1;
+		setsockopt(m_MetricsSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+		if (m_MetricsSocket < 0 || bind(m_MetricsSocket, (sockaddr*)&local, sizeof(local)) < 0 || listen(m_MetricsSocket, SOMAXCONN) < 0)
+			return false;
+	}
+	else
+	{
+		sockaddr_un local{};
+		local.sun_family = AF_UNIX;
+
+		if (address.size() >= sizeof(local.sun_path))
+			return false;
+
+		std::memcpy(local.sun_path, address.data(), address.size());
+
+		m_MetricsPath = address;
+		unlink(m_MetricsPath.c_str());
+
+		m_MetricsSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (m_MetricsSocket < 0 || bind(m_MetricsSocket, (sockaddr*)&local, sizeof(local)) < 0 || listen(m_MetricsSocket, SOMAXCONN) < 0)
+			return false;
+	}
+
+	fcntl(m_MetricsSocket, F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+void Server::Run()
+{
+	m_Running = true;
+
+	std::vector<pollfd> descriptors;
+	std::vector<Request> requests;
+
+	while (m_Running)
+	{
+		descriptors.assign({ { m_Socket, POLLIN, 0 }, { m_MetricsSocket, POLLIN, 0 } });
+
+		for (Connection& connection : m_Connections)
+			descriptors.push_back({ connection.fd, (short)(POLLIN | (connection.output.empty() ? 0 : POLLOUT)), 0 });
+
+		if (poll(descriptors.data(), descriptors.size(), 100) <= 0)
+			continue;
+
+		if (descriptors[0].revents & POLLIN)
+			Accept(m_Socket, false);
+
+		if (descriptors[1].revents & POLLIN)
+			Accept(m_MetricsSocket, true);
+
+		std::vector<size_t> consumed(m_Connections.size(), 0);
+		requests.clear();
+
+		// Every request that arrived during this poll round is dispatched together, so that
+		// concurrent requests for the same formula are evaluated as one batch.
+		for (size_t i = 2; i < descriptors.size(); i++)
+		{
+			Connection& connection = m_Connections[i - 2];
+
+			if (!(descriptors[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			Receive(i - 2);
+
+			if (connection.metrics)
+				ServeMetrics(connection);
+			else
+				consumed[i - 2] = ParseRequests(i - 2, requests);
+		}
+
+		Dispatch(requests);
+
+		for (size_t i = 0; i < consumed.size(); i++)
+		{
+			Connection& connection = m_Connections[i];
+
+			connection.input.erase(0, consumed[i]);
+			Send(connection);
+
+			if (connection.closing && connection.output.empty())
+				connection.closed = true;
+		}
+
+		std::erase_if(m_Connections, [](const Connection& connection)
+		{
+			if (connection.closed)
+				close(connection.fd);
+
+			return connection.closed;
+		});
+	}
+}
+
+void Server::Stop()
+{
+	m_Running = false;
+}
+
+int Server::Connect(std::string_view path)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(address.sun_path))
+		return -1;
+
+	std::memcpy(address.sun_path, path.data(), path.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void Server::EncodeRequest(std::string& output, uint32_t id, std::string_view formula, bool radians, uint32_t rows,
+	std::span<const std::string_view> names, std::span<const std::span<const double>> columns)
+{
+	size_t start = output.size();
+
+	WriteValue<uint32_t>(output, 0);
+	WriteValue<uint32_t>(output, id);
+	WriteValue<uint8_t>(output, radians ? 1 : 0);
+	WriteValue<uint32_t>(output, rows);
+	WriteValue<uint16_t>(output, (uint16_t)formula.size());
+	WriteValue<uint16_t>(output, (uint16_t)names.size());
+
+	output.append(formula);
+
+	for (std::string_view name : names)
+	{
+		WriteValue<uint16_t>(output, (uint16_t)name.size());
+		output.append(name);
+	}
+
+	for (std::span<const double> column : columns)
+		output.append((const char*)column.data(), rows * sizeof(double));
+
+	uint32_t size = (uint32_t)(output.size() - start - sizeof(uint32_t));
+	std::memcpy(output.data() + start, &size, sizeof(size));
+}
+
+bool Server::DecodeResponse(std::string_view& input, Response& response)
+{
+	if (input.size() < sizeof(uint32_t))
+		return false;
+
+	const char* cursor = input.data();
+	uint32_t size = ReadValue<uint32_t>(cursor);
+
+	if (input.size() < sizeof(uint32_t) + size)
+		return false;
+
+	response.id = ReadValue<uint32_t>(cursor);
+	response.state = (Parser::State)ReadValue<uint8_t>(cursor);
+
+	uint32_t rows = ReadValue<uint32_t>(cursor);
+
+	if (size != sizeof(uint32_t) * 2 + sizeof(uint8_t) + rows * sizeof(double))
+		return false;
+
+	response.values.resize(rows);
+
+	std::memcpy(response.values.data(), cursor, rows * sizeof(double));
+	input.remove_prefix(sizeof(uint32_t) + size);
+
+	return true;
+}
+
+void Server::Accept(int socket, bool metrics)
+{
+	while (true)
+	{
+		int fd = accept(socket, nullptr, nullptr);
+
+		if (fd < 0)
+			break;
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		m_Connections.push_back({ fd, {}, {}, metrics });
+	}
+}
+
+void Server::Receive(size_t index)
+{
+	Connection& connection = m_Connections[index];
+	char buffer[65536];
+
+	while (true)
+	{
+		ssize_t count = read(connection.fd, buffer, sizeof(buffer));
+
+		if (count > 0)
+			connection.input.append(buffer, count);
+		else
+		{
+			if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				connection.closed = true;
+
+			break;
+		}
+	}
+}
+
+void Server::Send(Connection& connection)
+{
+	size_t written = 0;
+
+	while (written < connection.output.size())
+	{
+		ssize_t count = send(connection.fd, connection.output.data() + written, connection.output.size() - written, MSG_NOSIGNAL);
+
+		if (count <= 0)
+		{
+			if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				connection.closed = true;
+
+			break;
+		}
+
+		written += count;
+	}
+
+	connection.output.erase(0, written);
+}
+
+void Server::ServeMetrics(Connection& connection)
+{
+	if (connection.closing || (connection.input.find("\r\n\r\n") == std::string::npos && connection.input.find("\n\n") == std::string::npos))
+		return;
+
+	std::string body = Metrics::Format();
+
+	connection.output = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	connection.closing = true;
+}
+
+size_t Server::ParseRequests(size_t index, std::vector<Request>& requests)
+{
+	Connection& connection = m_Connections[index];
+	size_t offset = 0;
+
+	while (connection.input.size() - offset >= sizeof(uint32_t))
+	{
+		const char* cursor = connection.input.data() + offset;
+		uint32_t size = ReadValue<uint32_t>(cursor);
+
+		constexpr size_t HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(uint8_t) + sizeof(uint16_t) * 2;
+
+		if (size > MAX_FRAME_SIZE || size < HEADER_SIZE)
+		{
+			connection.closed = true;
+			break;
+		}
+
+		if (connection.input.size() - offset - sizeof(uint32_t) < size)
+			break;
+
+		const char* end = cursor + size;
+
+		Request request;
+
+		request.connection = index;
+
+		request.id = ReadValue<uint32_t>(cursor);
+		request.radians = ReadValue<uint8_t>(cursor) & 1;
+		request.rows = ReadValue<uint32_t>(cursor);
+
+		uint16_t length = ReadValue<uint16_t>(cursor);
+		uint16_t variables = ReadValue<uint16_t>(cursor);
+
+		bool valid = cursor + length <= end;
+
+		request.formula = std::string_view(cursor, valid ? length : 0);
+		cursor += request.formula.size();
+
+		for (uint16_t i = 0; i < variables && valid; i++)
+		{
+			valid = cursor + sizeof(uint16_t) <= end;
+
+			if (valid)
+			{
+				length = ReadValue<uint16_t>(cursor);
+				valid = cursor + length <= end;
+			}
+
+			if (valid)
+			{
+				request.names.emplace_back(cursor, length);
+				cursor += length;
+			}
+		}
+
+		if (!valid || (size_t)(end - cursor) != (size_t)variables * request.rows * sizeof(double))
+		{
+			connection.closed = true;
+			break;
+		}
+
+		request.data = cursor;
+		requests.push_back(std::move(request));
+
+		offset += sizeof(uint32_t) + size;
+	}
+
+	return offset;
+}
+
+void Server::Dispatch(std::vector<Request>& requests)
+{
+	std::unordered_map<std::string, std::vector<size_t>> batches;
+
+	// Programs found below must outlive the batch, so room for all of them is made up front.
+	Evict(requests.size());
+
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		Parser::State state = Parser::State::Ok;
+		const Program* program = Find(requests[i], state);
+
+		if (!program)
+		{
+			Respond(requests[i], state, {});
+			continue;
+		}
+
+		std::string key((const char*)&program, sizeof(program));
+		key += requests[i].radians ? 'r' : 'd';
+
+		for (std::string_view name : requests[i].names)
+			key.append(name).push_back('\0');
+
+		batches[key].push_back(i);
+	}
+
+	std::vector<std::vector<double>> columns;
+	std::vector<double> output;
+
+	for (const auto& [key, batch] : batches)
+	{
+		const Request& first = requests[batch.front()];
+		const Program* program;
+		std::memcpy(&program, key.data(), sizeof(program));
+
+		size_t rows = 0;
+
+		for (size_t i : batch)
+			rows += requests[i].rows;
+
+		columns.resize(first.names.size());
+		Parser::Columns inputs(m_Parser.GetResource());
+
+		for (size_t j = 0; j < first.names.size(); j++)
+		{
+			columns[j].resize(rows);
+			size_t offset = 0;
+
+			for (size_t i : batch)
+			{
+				const Request& request = requests[i];
+
+				std::memcpy(columns[j].data() + offset, request.data + j * request.rows * sizeof(double), request.rows * sizeof(double));
+				offset += request.rows;
+			}
+
+			inputs.emplace(std::pmr::string(first.names[j], m_Parser.GetResource()), std::span<const double>(columns[j]));
+		}
+
+		output.resize(rows);
+		std::span<double> outputs[] = { output };
+
+		m_Parser.Evaluate(*program, first.radians, inputs, outputs);
+
+		Parser::State state = m_Parser.GetState();
+		size_t offset = 0;
+
+		for (size_t i : batch)
+		{
+			Respond(requests[i], state, state == Parser::State::Ok ? std::span<const double>(output).subspan(offset, requests[i].rows) : std::span<const double>());
+			offset += requests[i].rows;
+		}
+	}
+}
+
+const Program* Server::Find(const Request& request, Parser::State& state)
+{
+	for (std::string_view name : request.names)
+	{
+		if (!IsColumn(name))
+		{
+			state = Parser::State::InvalidInput;
+			return nullptr;
+		}
+	}
+
+	// The declared columns decide how the text splits into names, so they are part of the key.
+	std::string text(request.formula);
+
+	for (std::string_view name : request.names)
+		text.append(1, '\0').append(name);
+
+	auto known = m_Texts.find(text);
+
+	if (known != m_Texts.end())
+	{
+		Metrics::Add(Metrics::Counter::CacheHits);
+
+		m_Recent.splice(m_Recent.begin(), m_Recent, known->second.recent);
+		return &known->second.entry->program;
+	}
+
+	Metrics::Add(Metrics::Counter::CacheMisses);
+
+	// Columns are only known for this request, so they are declared on a copy. Evaluation binds them by name
+	// and fails on any name a later request leaves unbound.
+	Parser parser(m_Parser);
+
+	for (std::string_view name : request.names)
+		parser.AddVariable(name);
+
+	Expression canonical = parser.Parse(request.formula).Canonicalize();
+	state = parser.GetState();
+
+	if (!parser.IsOk())
+		return nullptr;
+
+	// Equal hashes only suggest the same formula; the canonical expressions decide.
+	uint64_t hash = canonical.Hash();
+	Entry* entry = nullptr;
+
+	for (auto [it, end] = m_Programs.equal_range(hash); it != end && !entry; it++)
+		if (it->second.canonical == canonical)
+			entry = &it->second;
+
+	if (!entry)
+	{
+		std::string_view inputs[] = { request.formula };
+		Program compiled = parser.Compile(inputs);
+
+		state = parser.GetState();
+
+		if (!parser.IsOk())
+			return nullptr;
+
+		entry = &m_Programs.emplace(hash, Entry{ std::move(canonical), std::move(compiled) })->second;
+	}
+
+	entry->texts++;
+	m_Recent.push_front(text);
+	m_Texts.emplace(std::move(text), Text{ hash, entry, m_Recent.begin() });
+
+	return &entry->program;
+}
+
+// Least recently used texts go first; a program goes with the last text that refers to it.
+void Server::Evict(size_t incoming)
+{
+	while (!m_Recent.empty() && m_Texts.size() + incoming > CACHE_CAPACITY)
+	{
+		auto text = m_Texts.find(m_Recent.back());
+		Entry* entry = text->second.entry;
+
+		if (--entry->texts == 0)
+		{
+			for (auto [it, end] = m_Programs.equal_range(text->second.hash); it != end; it++)
+			{
+				if (&it->second == entry)
+				{
+					m_Programs.erase(it);
+					Metrics::Add(Metrics::Counter::CacheEvictions);
+					break;
+				}
+			}
+		}
+
+		m_Texts.erase(text);
+		m_Recent.pop_back();
+	}
+}
+
+// Column names must be plain lower-case identifiers that don't hide a constant, function or keyword.
+bool Server::IsColumn(std::string_view name) const
+{
+	if (name.empty() || std::isdigit((unsigned char)name[0]))
+		return false;
+
+	for (char c : name)
+		if (!(std::islower((unsigned char)c) || std::isdigit((unsigned char)c) || c == '_'))
+			return false;
+
+	return !m_Parser.IsReserved(name);
+}
+
+void Server::Respond(const Request& request, Parser::State state, std::span<const double> values)
+{
+	std::string& output = m_Connections[request.connection].output;
+
+	WriteValue<uint32_t>(output, (uint32_t)(sizeof(uint32_t) * 2 + sizeof(uint8_t) + values.size_bytes()));
+	WriteValue<uint32_t>(output, request.id);
+	WriteValue<uint8_t>(output, (uint8_t)state);
+	WriteValue<uint32_t>(output, (uint32_t)values.size());
+
+	output.append((const char*)values.data(), values.size_bytes());
+}
+
+#endif
+
+#endif
@@ -3,18 +3,47 @@
 #define PARSER_IMPL
 #include "Parser.hpp"
 
-int main()
+#ifndef _WIN32
+#define SERVER_IMPL
+#include "Server.hpp"
+#endif
+
+int main(int argc, char** argv)
 {
 	Parser parser;
 
-	parser.AddFunction("exp", [&](long double a) { return std::exp(a); });
+	parser.AddFunction("exp", [](long double a) { return std::exp(a); });
+
+#ifndef _WIN32
+	if (argc > 2 && std::string_view(argv[1]) == "--server")
+	{
+		Server server(parser);
+
+		if (!server.Listen(argv[2]))
+		{
+			std::cerr << "Can't listen on " << argv[2] << std::endl;
+			return 1;
+		}
+
+		if (argc > 4 && std::string_view(argv[3]) == "--metrics" && !server.ListenMetrics(argv[4]))
+		{
+			std::cerr << "Can't listen on " << argv[4] << std::endl;
+			return 1;
+		}
+
+		server.Run();
+		return 0;
+	}
+#endif
 
 	while (1)
 	{
 		std::string input;
 
 		std::cout << ">>> ";
-		std::getline(std::cin, input);
+
+		if (!std::getline(std::cin, input))
+			break;
 
 		long double result = parser.Get(input, true);
 
@@ -28,6 +57,9 @@ int main()
 			case Parser::State::UnknownBinaryOperator: std::cerr << "Unknown binary operator" << std::endl; break;
 			case Parser::State::UnknownUnaryOperator: std::cerr << "Unknown unary operator" << std::endl; break;
 			case Parser::State::UnknownExpressionType: std::cerr << "Unknown expression type" << std::endl; break;
+			case Parser::State::InvalidInput: std::cerr << "Invalid input" << std::endl; break;
+			case Parser::State::Cancelled: std::cerr << "Cancelled" << std::endl; break;
+			case Parser::State::ReadFailed: std::cerr << "Read failed" << std::endl; break;
 			}
 		}
 	}
@@ -0,0 +1,932 @@
+#include <iostream>
+#include <future>
+#include <numeric>
+
+#define PARSER_IMPL
+#include "Parser.hpp"
+
+#define SERVER_IMPL
+#include "Server.hpp"
+
+static int s_Failures = 0;
+
+static void Check(bool condition, std::string_view what)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		s_Failures++;
+	}
+}
+
+static bool Same(long double a, long double b)
+{
+	return (std::isnan(a) && std::isnan(b)) || (a == b && std::signbit(a) == std::signbit(b));
+}
+
+static void TestPowerSpecialCases()
+{
+	constexpr long double INF = std::numeric_limits<long double>::infinity();
+
+	Parser parser;
+	parser.AddVariable("x");
+
+	for (long double exponent : { 0.5L, -0.5L })
+	{
+		std::string formula = "x ^ " + std::string(exponent < 0 ? "(0 - 0.5)" : "0.5");
+
+		for (long double base : { 0.0L, -0.0L, INF, -INF, 4.0L })
+		{
+			parser.SetVariable("x", base);
+
+			long double scalar = parser.Get(formula, true);
+			Check(Same(scalar, std::pow(base, exponent)), "scalar " + formula + " matches pow");
+
+			double column[] = { (double)base };
+			double output[1];
+
+			Parser::Columns inputs;
+			inputs.emplace("x", std::span<const double>(column));
+
+			parser.Get(formula, true, inputs, output);
+			Check(Same(output[0], std::pow((double)base, (double)exponent)), "batch " + formula + " matches pow");
+		}
+	}
+}
+
+static void TestCubeRoot()
+{
+	Parser parser;
+	parser.AddVariable("x", 27.0L);
+
+	double column[] = { 27.0, 0.125, 0.0 };
+	double expected[] = { 3.0, 0.5, 0.0 };
+	double output[3];
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	parser.Get("x ^ (1/3)", true, inputs, output);
+
+	for (size_t i = 0; i < std::size(column); i++)
+		Check(output[i] == expected[i], "batch x ^ (1/3) uses cbrt");
+
+	Check(parser.Get("x ^ (1/3)", true) == cbrtl(27.0L), "scalar x ^ (1/3) uses cbrt");
+}
+
+static void TestStateReset()
+{
+	Parser parser;
+	parser.AddVariable("x", 2.0L);
+
+	Expression expr = parser.Parse("x * 3");
+
+	parser.Get("1 +", true);
+	Check(!parser.IsOk(), "incomplete formula fails");
+	Check(parser.Evaluate(expr, true) == 6.0L && parser.IsOk(), "scalar Evaluate resets the state");
+
+	double column[] = { 1.0, 2.0 };
+	double output[2];
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	parser.Get("1 +", true);
+	Check(parser.Evaluate(expr, true, inputs, output) && output[1] == 6.0, "batch Evaluate resets the state");
+}
+
+static void TestBuiltinOverride()
+{
+	Parser parser;
+	parser.AddVariable("x", 1.0L);
+	parser.AddFunction("sin", [](long double a) { return a * 1000.0L; });
+	parser.AddFunction("sin", [](std::span<const double> in, std::span<double> out)
+	{
+		for (size_t i = 0; i < in.size(); i++)
+			out[i] = in[i] * 1000.0;
+	});
+
+	double column[] = { 1.0 };
+	double output[1];
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	long double scalar = parser.Get("sin(x)", true);
+	parser.Get("sin(x)", true, inputs, output);
+
+	Check(scalar == std::sin(1.0L), "builtin sin is not overridden in scalar evaluation");
+	Check(std::fabs(output[0] - (double)scalar) < 1e-15, "batch and scalar agree after an override attempt");
+
+	std::string_view names[] = { "f" };
+	std::string_view formulas[] = { "sin(x)" };
+	Program program = parser.Compile(formulas);
+
+	parser.Translate(names, std::span<const Program>(&program, 1), true);
+	Check(parser.IsOk(), "sin still translates as a builtin");
+}
+
+static void TestBuiltinConstantOverride()
+{
+	Parser parser;
+	parser.AddConstant("pi", 3.0L);
+	parser.AddConstant("e", 2.0L);
+	parser.AddConstant("tau", 6.0L);
+
+	Check(parser.Get("pi", true) == std::numbers::pi_v<long double>, "builtin pi is not overridden");
+	Check(parser.Get("e", true) == std::numbers::e_v<long double>, "builtin e is not overridden");
+	Check(parser.Get("tau * 2", true) == 12.0L, "user constants still register");
+}
+
+static void TestMultiStatement()
+{
+	Parser parser;
+	parser.AddVariable("x");
+
+	double column[] = { 1.0, 2.0, 3.0 };
+	double output[3];
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	for (std::string formula : { "x+1; 2", "let a = x; x*10; a+100", "x; let b = x*2; b; b+1", "let c = x; c" })
+	{
+		parser.Get(formula, true, inputs, output);
+
+		for (size_t i = 0; i < std::size(column); i++)
+		{
+			parser.SetVariable("x", column[i]);
+			Check(output[i] == (double)parser.Get(formula, true), "batch and scalar agree on \"" + formula + "\"");
+		}
+	}
+}
+
+static void TestDefinitions()
+{
+	Parser parser;
+	parser.AddVariable("x", 2.0L);
+
+	Check(parser.Get("def twice(a) = a * 2; twice(x) + 1", true) == 5.0L, "a definition is usable in its own formula");
+	Check(parser.Get("twice(3)", true) == 6.0L, "a definition outlives its formula");
+
+	const char* reserved[] = { "def sin(a) = a * 2", "def pi() = 3", "def let(a) = a", "def e(a) = a" };
+
+	for (const char* formula : reserved)
+	{
+		parser.Get(formula, true);
+		Check(!parser.IsOk(), "reserved names cannot be defined");
+	}
+
+	Check(parser.Get("sin(0)", true) == 0.0L, "builtin sin survives a rejected definition");
+	Check(parser.Get("pi", true) == std::numbers::pi_v<long double>, "builtin pi survives a rejected definition");
+
+	parser.Get("def half(a) = a / 2; 1 +", true);
+	Check(!parser.IsOk(), "a formula with a syntax error fails");
+
+	parser.Get("half(4)", true);
+	Check(!parser.IsOk(), "definitions in a failed formula are discarded");
+
+	std::string_view inputs[] = { "def cube(a) = a * a * a" };
+	Program program = parser.Compile(inputs);
+
+	Check(parser.GetState() == Parser::State::UnknownExpressionType && program.code.empty(), "a formula of definitions alone compiles to nothing");
+}
+
+static void TestDocument()
+{
+	Parser parser;
+	parser.AddVariable("x", 2.0L);
+
+	Document document = parser.Open("x * 3");
+	Check(parser.Evaluate(document, true) == 6.0L, "document evaluates");
+
+	parser.SetVariable("x", 10.0L);
+	Check(parser.Evaluate(document, true) == 30.0L, "document sees a variable change");
+
+	parser.Edit(document, 5, 0, " + 1");
+	Check(parser.Evaluate(document, true) == 31.0L, "top-level append");
+
+	parser.Edit(document, 0, 1, "(x - 4)");
+	Check(parser.Evaluate(document, true) == 19.0L, "top-level replacement");
+
+	parser.Edit(document, 5, 1, "8");
+	Check(parser.Evaluate(document, true) == 7.0L, "edit inside a group");
+
+	parser.Edit(document, document.text.size(), 0, " * 2");
+	Check(parser.Evaluate(document, true) == 8.0L, "append binding tighter than the previous root");
+
+	// Typing a formula one keystroke at a time must agree with parsing it from scratch.
+	std::string_view typed = "(1+2)*3-4/2+x^2-sin(x)*5";
+	document = parser.Open("");
+
+	Parser reference;
+	reference.AddVariable("x", 10.0L);
+
+	for (size_t i = 0; i < typed.size(); i++)
+	{
+		parser.Edit(document, i, 0, typed.substr(i, 1));
+
+		if (!parser.IsOk())
+			continue;
+
+		long double incremental = parser.Evaluate(document, true);
+		long double fresh = reference.Get(typed.substr(0, i + 1), true);
+
+		Check(incremental == fresh, "keystroke edits match a fresh parse");
+	}
+}
+
+static void TestTranslate()
+{
+	Parser parser;
+	parser.AddVariable("x");
+	parser.AddConstant("big", std::numeric_limits<long double>::infinity());
+	parser.AddConstant("bad", std::numeric_limits<long double>::quiet_NaN());
+
+	std::string_view names[] = { "odd \"name\"\\\n", "limits", "dead" };
+	std::string_view first[] = { "x + 1" }, second[] = { "x + big - bad" }, third[] = { "let a = x * 3; x * 5; 2 + x" };
+	Program programs[] = { parser.Compile(first), parser.Compile(second), parser.Compile(third) };
+
+	std::string source = parser.Translate(names, programs, true);
+
+	Check(parser.IsOk(), "single-output programs translate");
+	Check(source.find("\"odd \\\"name\\\"\\\\\\012\"") != std::string::npos, "formula names are escaped");
+	Check(source.find("std::numeric_limits<long double>::infinity()") != std::string::npos, "infinite constants use numeric_limits");
+	Check(source.find("std::numeric_limits<double>::quiet_NaN()") != std::string::npos, "NaN constants use numeric_limits");
+	Check(source.find("(3.0L)") == std::string::npos && source.find("(5.0)") == std::string::npos, "dead registers are not emitted");
+
+	std::string_view outputs[] = { "x", "x + 1" };
+	Program multiple = parser.Compile(outputs);
+
+	parser.Translate(std::span<const std::string_view>(names, 1), std::span<const Program>(&multiple, 1), true);
+	Check(!parser.IsOk(), "programs with several outputs are rejected");
+}
+
+static void TestCanonicalize()
+{
+	Parser parser;
+	parser.AddVariable("x", 1.5L);
+
+	Check(parser.Hash("1/-0") != parser.Hash("1/0"), "zeros of different sign hash differently");
+	Check(parser.Hash("x*2 + 1") == parser.Hash("1 + 2*x"), "commutative operands still hash alike");
+
+	std::string chain = "let a0 = x";
+
+	for (int i = 1; i <= 22; i++)
+		chain += "; let a" + std::to_string(i) + " = a" + std::to_string(i - 1) + " + a" + std::to_string(i - 1) + " * 0.5";
+
+	chain += "; a22";
+
+	Expression expr = parser.Parse(chain);
+	Expression canonical = expr.Canonicalize();
+
+	Check(canonical.Size() <= expr.Size(), "canonicalizing a chain of lets stays linear");
+	Check(canonical.Hash() == expr.Hash(), "canonical form hashes like the original");
+
+	Graph graph;
+	graph.Add(canonical);
+	Program program = parser.Compile(graph);
+
+	double column[] = { 1.5 };
+	double output[1];
+	std::span<double> outputs[] = { output };
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	parser.Evaluate(program, true, inputs, outputs);
+	Check(output[0] == (double)parser.Get(chain, true), "canonical form evaluates like the original");
+}
+
+static void TestStreaming()
+{
+	Parser parser;
+	parser.AddVariable("x", 2.0L);
+
+	// A name and a number longer than the stream's lookahead window, read back a few bytes at a time.
+	std::string name(6000, 'q');
+	std::string number = std::string(5000, '0') + "5";
+	std::string text = "def twice(a) = a * 2; let " + name + " = x * 3; let b = " + name + " + 1; " + number + " * 0 + twice(b) + sin(x)";
+
+	double expected = (double)parser.Get(text, true);
+
+	for (size_t chunk : { 1, 3, 7, 65536 })
+	{
+		size_t position = 0;
+
+		Parser::Reader reader([&](std::span<char> buffer)
+		{
+			size_t count = std::min({ chunk, buffer.size(), text.size() - position });
+			std::memcpy(buffer.data(), text.data() + position, count);
+			position += count;
+			return count;
+		});
+
+		Program program = parser.Compile(reader);
+		Check(parser.IsOk(), "streamed input compiles with " + std::to_string(chunk) + "-byte chunks");
+
+		double column[] = { 2.0 };
+		double output[1];
+		std::span<double> outputs[] = { output };
+
+		Parser::Columns inputs;
+		inputs.emplace("x", std::span<const double>(column));
+
+		parser.Evaluate(program, true, inputs, outputs);
+		Check(output[0] == expected, "streamed program matches the string parse with " + std::to_string(chunk) + "-byte chunks");
+	}
+}
+
+static void TestReadErrors()
+{
+	Parser parser;
+
+	parser.Compile(-1);
+	Check(parser.GetState() == Parser::State::ReadFailed, "a bad descriptor is a read error, not a syntax error");
+
+	// A valid prefix followed by a failure must not compile as if the input ended there.
+	bool failed = false;
+
+	Parser::Reader reader([&](std::span<char> buffer)
+	{
+		if (failed)
+			return Parser::READ_FAILED;
+
+		failed = true;
+		std::memcpy(buffer.data(), "1 + 2", 5);
+		return (size_t)5;
+	});
+
+	parser.Compile(reader);
+	Check(parser.GetState() == Parser::State::ReadFailed, "a read error after a valid prefix is reported");
+
+	int pipes[2];
+
+	if (pipe(pipes) == 0)
+	{
+		Check(write(pipes[1], "1 + 2; 3 * 4", 12) == 12, "pipe write");
+		close(pipes[1]);
+
+		Program program = parser.Compile(pipes[0]);
+		close(pipes[0]);
+
+		Check(parser.IsOk(), "a program compiles from a descriptor");
+
+		double output[1];
+		std::span<double> outputs[] = { output };
+
+		parser.Evaluate(program, true, Parser::Columns(), outputs);
+		Check(output[0] == 12.0, "a program read from a descriptor evaluates");
+	}
+}
+
+struct Task
+{
+	struct promise_type
+	{
+		Task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// Coroutine lambdas would outlive their captures, so the coroutines take everything as parameters.
+static Task AwaitEvaluation(Parser& parser, const Program& program, const Parser::Columns& inputs, std::span<const std::span<double>> outputs,
+	Parser::Resume resume, Parser::State& state, std::thread::id& resumed)
+{
+	state = co_await parser.EvaluateAsync(program, true, inputs, outputs, {}, std::move(resume));
+	resumed = std::this_thread::get_id();
+}
+
+static Task AwaitNested(Parser& parser, const Program& program, const Parser::Columns& inputs, std::span<const std::span<double>> outputs,
+	std::span<const std::span<double>> nested, std::promise<bool>& finished)
+{
+	Parser::State state = co_await parser.EvaluateAsync(program, true, inputs, outputs);
+
+	Parser worker = parser;
+	worker.SetResource(std::pmr::new_delete_resource());
+
+	finished.set_value(state == Parser::State::Ok && worker.EvaluateParallel(program, true, inputs, nested));
+}
+
+static void TestAsync()
+{
+	Parser parser;
+	parser.AddVariable("x", 0.0L);
+
+	Program program = parser.Compile(std::array<std::string_view, 1>{ "x * 2 + 1" });
+
+	std::vector<double> column(200000);
+	std::iota(column.begin(), column.end(), 0.0);
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	// With a resume hook, the coroutine continues on the thread that drains the hook's queue.
+	std::vector<double> output(column.size());
+	std::span<double> outputs[] = { output };
+
+	std::mutex mutex;
+	std::condition_variable posted;
+	std::coroutine_handle<> pending;
+
+	Parser::Resume resume([&](std::coroutine_handle<> caller)
+	{
+		std::lock_guard lock(mutex);
+		pending = caller;
+		posted.notify_one();
+	});
+
+	std::thread::id resumed;
+	Parser::State state = Parser::State::InvalidInput;
+
+	AwaitEvaluation(parser, program, inputs, outputs, resume, state, resumed);
+
+	{
+		std::unique_lock lock(mutex);
+		posted.wait(lock, [&]() { return pending != nullptr; });
+	}
+
+	pending.resume();
+
+	Check(state == Parser::State::Ok && resumed == std::this_thread::get_id(), "the resume hook decides where the coroutine continues");
+	Check(output.front() == 1.0 && output.back() == column.back() * 2 + 1, "async evaluation fills the output");
+
+	// Without one, it continues on the pool, and parallel work started from there must not wait on itself.
+	std::vector<double> nested(column.size());
+	std::span<double> nestedOutputs[] = { nested };
+	std::promise<bool> finished;
+
+	AwaitNested(parser, program, inputs, outputs, nestedOutputs, finished);
+
+	std::future<bool> result = finished.get_future();
+
+	if (result.wait_for(std::chrono::seconds(30)) != std::future_status::ready)
+	{
+		std::cerr << "FAILED: parallel evaluation nested in a pool job deadlocks" << std::endl;
+		std::_Exit(1);
+	}
+
+	Check(result.get() && nested == output, "parallel evaluation nested in a pool job completes");
+
+	// A single thread makes any wait on the pool from inside it a deadlock.
+	WorkerPool single(1);
+	std::promise<size_t> counted;
+
+	single.Submit([&]()
+	{
+		std::atomic<size_t> rows = 0;
+		single.ForEach(3 * WorkerPool::CHUNK_SIZE, [&](size_t, size_t count) { rows += count; });
+		counted.set_value(rows);
+	});
+
+	std::future<size_t> rows = counted.get_future();
+
+	if (rows.wait_for(std::chrono::seconds(30)) != std::future_status::ready)
+	{
+		std::cerr << "FAILED: ForEach from a pool thread deadlocks" << std::endl;
+		std::_Exit(1);
+	}
+
+	Check(rows.get() == 3 * WorkerPool::CHUNK_SIZE, "ForEach from a pool thread covers every row");
+}
+
+static void TestServer()
+{
+	Parser parser;
+	Server server(parser);
+
+	std::string path = "/tmp/mathparser-tests-" + std::to_string(getpid()) + ".sock";
+	unlink(path.c_str());
+
+	if (!server.Listen(path))
+	{
+		Check(false, "the server listens");
+		return;
+	}
+
+	std::thread thread([&]() { server.Run(); });
+	int fd = Server::Connect(path);
+
+	auto ask = [&](std::string_view formula, std::vector<std::string_view> names, std::vector<double> values)
+	{
+		std::vector<std::span<const double>> columns;
+
+		for (double& value : values)
+			columns.emplace_back(&value, 1);
+
+		std::string request;
+		Server::EncodeRequest(request, 1, formula, true, 1, names, columns);
+		Check(write(fd, request.data(), request.size()) == (ssize_t)request.size(), "request is sent");
+
+		std::string input;
+		Server::Response response = { 0, Parser::State::InvalidInput, {} };
+		char buffer[4096];
+
+		while (true)
+		{
+			ssize_t count = read(fd, buffer, sizeof(buffer));
+
+			if (count <= 0)
+				break;
+
+			input.append(buffer, count);
+			std::string_view view = input;
+
+			if (Server::DecodeResponse(view, response))
+				break;
+		}
+
+		return response;
+	};
+
+	Server::Response response = ask("x * 2 + 1", { "x" }, { 3.0 });
+	Check(response.state == Parser::State::Ok && response.values == std::vector<double>{ 7.0 }, "the server evaluates a request");
+
+	response = ask("ab", { "ab" }, { 3.0 });
+	Check(response.state == Parser::State::Ok && response.values == std::vector<double>{ 3.0 }, "a column named ab");
+
+	response = ask("ab", { "a", "b" }, { 2.0, 5.0 });
+	Check(response.state != Parser::State::Ok || response.values != std::vector<double>{ 3.0 }, "the same text with other columns is not served from the cache");
+
+	auto delta = [](const Metrics::Snapshot& from, const Metrics::Snapshot& to, Metrics::Counter counter)
+	{
+		return to.counters[(size_t)counter] - from.counters[(size_t)counter];
+	};
+
+	Metrics::Snapshot before = Metrics::Read();
+	response = ask("1 + 2 * x", { "x" }, { 3.0 });
+	Metrics::Snapshot after = Metrics::Read();
+
+	Check(response.values == std::vector<double>{ 7.0 } && delta(before, after, Metrics::Counter::FormulasCompiled) == 0,
+		"a text with the same canonical form shares the compiled program");
+
+	// Keep one formula in use while the cache fills past its capacity; only the oldest idle texts may go.
+	before = Metrics::Read();
+
+	for (size_t i = 0; i <= Server::CACHE_CAPACITY; i++)
+	{
+		if (i % 64 == 0)
+			ask("x * 2 + 1", { "x" }, { 1.0 });
+
+		ask("x + " + std::to_string(i), { "x" }, { 1.0 });
+	}
+
+	Metrics::Snapshot middle = Metrics::Read();
+	response = ask("x * 2 + 1", { "x" }, { 1.0 });
+	after = Metrics::Read();
+
+	size_t evictions = delta(before, middle, Metrics::Counter::CacheEvictions);
+
+	Check(evictions > 0 && evictions < 16, "eviction removes single entries, not the whole cache");
+	Check(delta(middle, after, Metrics::Counter::CacheHits) == 1 && response.values == std::vector<double>{ 3.0 }, "a recently used formula survives eviction");
+
+	close(fd);
+	server.Stop();
+	thread.join();
+	unlink(path.c_str());
+}
+
+static void TestMetrics()
+{
+	Metrics::Snapshot before = Metrics::Read();
+
+	// Counters from threads that have already exited must still be counted.
+	std::thread([]()
+	{
+		Parser parser;
+		parser.Get("1 + 2", true);
+		parser.Get("1 +", true);
+	}).join();
+
+	Metrics::Snapshot after = Metrics::Read();
+
+	Check(after.counters[(size_t)Metrics::Counter::Evaluations] > before.counters[(size_t)Metrics::Counter::Evaluations], "evaluations are counted");
+	Check(after.errors[(size_t)Parser::State::InvalidSyntax] == before.errors[(size_t)Parser::State::InvalidSyntax] + 1, "a syntax error is counted once");
+
+	Parser parser;
+	Server server(parser);
+
+	std::string path = "/tmp/mathparser-metrics-" + std::to_string(getpid()) + ".sock";
+
+	if (!server.Listen(path + ".requests") || !server.ListenMetrics(path))
+	{
+		Check(false, "the metrics endpoint listens");
+		return;
+	}
+
+	std::thread thread([&]() { server.Run(); });
+	int fd = Server::Connect(path);
+
+	std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+	Check(write(fd, request.data(), request.size()) == (ssize_t)request.size(), "metrics request is sent");
+
+	std::string response;
+	char buffer[4096];
+
+	for (ssize_t count; (count = read(fd, buffer, sizeof(buffer))) > 0;)
+		response.append(buffer, count);
+
+	close(fd);
+	server.Stop();
+	thread.join();
+	unlink((path + ".requests").c_str());
+
+	Check(response.starts_with("HTTP/1.0 200 OK"), "the metrics endpoint answers over HTTP");
+	Check(response.find("# TYPE mathparser_evaluations_total counter") != std::string::npos, "counters are exposed in Prometheus format");
+	Check(response.find("mathparser_errors_total{state=\"invalid_syntax\"}") != std::string::npos, "errors are exposed by state");
+}
+
+static void TestPlacement()
+{
+	// Two equal nodes: a pool smaller than the machine still uses both.
+	std::vector<std::vector<int>> equal = { { 0, 1, 2, 3 }, { 4, 5, 6, 7 } };
+	auto placement = WorkerPool::Place(equal, 2);
+
+	Check(placement.size() == 2 && placement[0] == std::pair(0u, 0) && placement[1] == std::pair(1u, 4), "two threads spread over two nodes");
+
+	placement = WorkerPool::Place(equal, 10);
+	unsigned first = (unsigned)std::count_if(placement.begin(), placement.end(), [](auto p) { return p.first == 0; });
+
+	Check(first == 5, "threads beyond the CPU count stay balanced");
+	Check(placement[8] == std::pair(0u, 0) && placement[9] == std::pair(1u, 4), "CPUs are reused in turn once a node is full");
+
+	// A node three times the size of the other gets three times the threads.
+	std::vector<std::vector<int>> uneven = { { 0, 1, 2, 3, 4, 5 }, { 6, 7 } };
+	placement = WorkerPool::Place(uneven, 4);
+	first = (unsigned)std::count_if(placement.begin(), placement.end(), [](auto p) { return p.first == 0; });
+
+	Check(first == 3, "threads follow node sizes");
+
+	placement = WorkerPool::Place({}, 3);
+	Check(placement.size() == 3 && placement[0] == std::pair(0u, -1), "an unknown topology leaves threads unpinned on node 0");
+}
+
+static void TestApproximation()
+{
+	Parser parser;
+	parser.AddVariable("x");
+	parser.AddVariable("y");
+	parser.SetRange("x", 0.0L, 3.0L);
+
+	std::string_view bounded[] = { "sin(x) + ln(x / 2 + 1)" };
+	std::string_view unbounded[] = { "sin(y)" };
+
+	Program exact = parser.Compile(bounded);
+	Program program = exact;
+
+	Metrics::Snapshot before = Metrics::Read();
+	Parser::Approximation approximation = parser.Approximate(program, true);
+	Metrics::Snapshot after = Metrics::Read();
+
+	Check(approximation.tables == 2 && program.tables.size() == 2, "both bounded call sites get a table");
+	Check(approximation.entries > 0 && approximation.bytes > 0, "table sizes are reported");
+	Check(approximation.maxError <= Parser::TABLE_TOLERANCE, "tables stay within tolerance");
+	Check(after.counters[(size_t)Metrics::Counter::TablesBuilt] - before.counters[(size_t)Metrics::Counter::TablesBuilt] == 2,
+		"built tables are counted");
+
+	Program open = parser.Compile(unbounded);
+	Check(parser.Approximate(open, true).tables == 0 && open.tables.empty(), "unbounded arguments are not tabulated");
+
+	size_t rows = 1000;
+	std::vector<double> x(rows), y(rows, 0.0), approximated(rows), reference(rows);
+
+	for (size_t i = 0; i < rows; i++)
+		x[i] = 3.0 * (double)i / (double)(rows - 1);
+
+	Parser::Columns inputs;
+	inputs.emplace("x", x);
+	inputs.emplace("y", y);
+
+	std::span<double> approximatedOutputs[] = { approximated };
+	std::span<double> referenceOutputs[] = { reference };
+
+	Check(parser.Evaluate(program, true, inputs, approximatedOutputs) && parser.Evaluate(exact, true, inputs, referenceOutputs),
+		"approximated programs evaluate");
+
+	double worst = 0.0;
+
+	for (size_t i = 0; i < rows; i++)
+		worst = std::max(worst, std::abs(approximated[i] - reference[i]));
+
+	Check(worst <= 2 * Parser::TABLE_TOLERANCE, "approximated results match the exact ones");
+
+	// Tables are tied to the angle unit they were built for.
+	Check(parser.Evaluate(program, false, inputs, approximatedOutputs) && parser.Evaluate(exact, false, inputs, referenceOutputs),
+		"approximated programs evaluate in degrees");
+	Check(approximated == reference, "tables built for radians are ignored in degrees");
+}
+
+static void TestAlignedResource()
+{
+	AlignedResource small(std::pmr::new_delete_resource(), false);
+
+	for (size_t bytes : { 1, 24, 100, 4096 })
+	{
+		void* block = small.allocate(bytes, alignof(double));
+		Check((uintptr_t)block % AlignedResource::CACHE_LINE == 0, "blocks are cache-line aligned");
+		small.deallocate(block, bytes, alignof(double));
+	}
+
+	AlignedResource* shared = AlignedResource::Shared();
+	size_t bytes = AlignedResource::HUGE_PAGE_SIZE + 123;
+	char* block = (char*)shared->allocate(bytes, alignof(double));
+
+#ifdef __linux__
+	Check((uintptr_t)block % AlignedResource::HUGE_PAGE_SIZE == 0, "large blocks start on a huge page boundary");
+#endif
+
+	std::fill_n(block, bytes, 1);
+	Check(block[0] == 1 && block[bytes - 1] == 1, "the whole large block is writable");
+	shared->deallocate(block, bytes, alignof(double));
+
+	// Aligned, huge and deliberately misaligned columns must give the same results.
+	Parser parser;
+	parser.AddVariable("x");
+
+	std::string_view formulas[] = { "x * x + sin(x)" };
+	Program program = parser.Compile(formulas);
+
+	size_t rows = AlignedResource::HUGE_PAGE_SIZE / sizeof(double) + 7;
+	std::pmr::vector<double> aligned(rows, shared), output(rows, shared);
+	std::vector<double> misaligned(rows + 1), reference(rows + 1);
+
+	for (size_t i = 0; i < rows; i++)
+		aligned[i] = misaligned[i + 1] = 0.001 * (double)i;
+
+	auto evaluate = [&](std::span<const double> column, std::span<double> target)
+	{
+		Parser::Columns inputs;
+		inputs.emplace("x", column);
+		std::span<double> outputs[] = { target };
+
+		return parser.Evaluate(program, true, inputs, outputs);
+	};
+
+	Check(evaluate(aligned, output) && evaluate(std::span<const double>(misaligned).subspan(1), std::span<double>(reference).subspan(1)),
+		"aligned and misaligned columns evaluate");
+	Check(std::equal(output.begin(), output.end(), reference.begin() + 1), "aligned and misaligned columns agree");
+}
+
+static void TestFixedPoint()
+{
+	FixedPoint fixed(31, 32);
+
+	int64_t a = fixed.FromDouble(1.25), b = fixed.FromDouble(-3.5);
+
+	Check(fixed.ToDouble(fixed.Multiply(a, b)) == -4.375, "fixed-point multiply");
+	Check(std::fabs(fixed.ToDouble(fixed.Divide(a, b)) + 1.25 / 3.5) < 1e-9, "fixed-point divide");
+	Check(std::fabs(fixed.ToDouble(fixed.ToDegrees(fixed.FromDouble(1.0))) - 180.0 / std::numbers::pi) < 1e-8, "fixed-point degrees");
+
+	size_t saturations = fixed.GetSaturations();
+	int64_t large = fixed.FromDouble(2e9);
+
+	Check(fixed.Multiply(large, large) == fixed.FromDouble(1e300) && fixed.GetSaturations() > saturations, "overflow saturates");
+
+	const char* functions[] = { "sin", "cos", "tan", "atan", "sqrt", "ln", "lg", "log2" };
+
+	for (const char* function : functions)
+	{
+		int64_t result;
+		Check(fixed.Call(function, a, result), "fixed-point function exists");
+
+		Parser parser;
+		long double expected = parser.Get(std::string(function) + "(1.25)", true);
+
+		Check(std::fabs(fixed.ToDouble(result) - (double)expected) < 1e-8, std::string("fixed-point ") + function);
+	}
+
+	Parser parser;
+	parser.AddVariable("x");
+
+	std::string_view formulas[] = { "x * 3 + sin(x) - sqrt(x)" };
+	Program program = parser.Compile(formulas);
+
+	double column[] = { 0.5, 1.0, 2.0, 100.0 };
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	fixed = FixedPoint(31, 32);
+
+	FixedPoint::Report report = parser.CompareFixed(program, fixed, true, inputs);
+	Check(parser.IsOk() && report.rows == 4 && report.saturations == 0 && report.maxError < 1e-8, "fixed-point program tracks double");
+
+	int64_t fixedColumn[4], output[4];
+
+	for (size_t i = 0; i < 4; i++)
+		fixedColumn[i] = fixed.FromDouble(column[i]);
+
+	Parser::FixedColumns fixedInputs;
+	fixedInputs.emplace("x", std::span<const int64_t>(fixedColumn));
+	std::span<int64_t> outputs[] = { output };
+
+	parser.EvaluateFixed(program, fixed, true, fixedInputs, outputs);
+	Check(parser.IsOk() && std::fabs(fixed.ToDouble(output[3]) - (300.0 + std::sin(100.0) - 10.0)) < 1e-7, "fixed-point evaluation");
+}
+
+static void TestMixedPrecision()
+{
+	Parser parser;
+	parser.AddVariable("x");
+
+	double column[] = { 0.9 + 1e-13, 2.0, 1e-10 };
+	double output[3];
+	std::span<double> outputs[] = { output };
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	auto evaluate = [&](std::string_view formula)
+	{
+		std::string_view formulas[] = { formula };
+		Program program = parser.Compile(formulas);
+
+		size_t refined = 0;
+		parser.EvaluateMixed(program, true, inputs, outputs, Parser::MIXED_TOLERANCE, &refined);
+
+		return refined;
+	};
+
+	Check(evaluate("x * 2") == 0, "well-conditioned rows stay in double");
+	Check(evaluate("(x + 1) - 1") > 0 && output[2] == (double)((1e-10L + 1.0L) - 1.0L), "cancelling rows are refined in long double");
+	Check(evaluate("sqrt(x + 0.1)") == 0, "sqrt halves its argument's error");
+	Check(evaluate("ln(x + 0.1)") == 1 && output[0] == (double)logl((long double)column[0] + 0.1L), "ln near 1 is refined");
+	Check(evaluate("tan(x + 0.1)") == 0, "tan away from a pole stays in double");
+
+	column[0] = std::numbers::pi / 2 - 0.1 + 1e-9;
+	Check(evaluate("tan(x + 0.1)") == 1, "tan near a pole is refined");
+}
+
+static void TestSumMetrics()
+{
+	Parser parser;
+	parser.AddVariable("x");
+
+	std::vector<double> column(3 * WorkerPool::CHUNK_SIZE, 1.0);
+
+	Parser::Columns inputs;
+	inputs.emplace("x", std::span<const double>(column));
+
+	std::string_view formulas[] = { "x * 2" };
+	Program program = parser.Compile(formulas);
+
+	Metrics::Snapshot before = Metrics::Read();
+
+	double sum = 0.0;
+	parser.EvaluateSum(program, true, inputs, column.size(), std::span<double>(&sum, 1));
+
+	Metrics::Snapshot after = Metrics::Read();
+
+	auto delta = [&](Metrics::Counter counter) { return after.counters[(size_t)counter] - before.counters[(size_t)counter]; };
+
+	Check(sum == 2.0 * column.size(), "sum of a constant column");
+	Check(delta(Metrics::Counter::Evaluations) == 1 && delta(Metrics::Counter::RowsEvaluated) == column.size(), "a sum is recorded once with all its rows");
+
+	// Enough threads to take the parallel path even on a single CPU.
+	WorkerPool pool(4);
+	std::vector<double> output(column.size());
+	std::span<double> outputs[] = { output };
+
+	before = Metrics::Read();
+	parser.EvaluateParallel(program, true, inputs, outputs, pool);
+	after = Metrics::Read();
+
+	Check(output.back() == 2.0, "parallel evaluation of a constant column");
+	Check(delta(Metrics::Counter::Evaluations) == 1 && delta(Metrics::Counter::RowsEvaluated) == column.size(), "a parallel evaluation is recorded once with all its rows");
+}
+
+int main()
+{
+	TestPowerSpecialCases();
+	TestCubeRoot();
+	TestStateReset();
+	TestBuiltinOverride();
+	TestBuiltinConstantOverride();
+	TestMultiStatement();
+	TestDefinitions();
+	TestDocument();
+	TestTranslate();
+	TestCanonicalize();
+	TestStreaming();
+	TestReadErrors();
+	TestAsync();
+	TestServer();
+	TestMetrics();
+	TestPlacement();
+	TestApproximation();
+	TestAlignedResource();
+	TestFixedPoint();
+	TestMixedPrecision();
+	TestSumMetrics();
+
+	if (s_Failures > 0)
+	{
+		std::cerr << s_Failures << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "All tests passed" << std::endl;
+	return 0;
+}